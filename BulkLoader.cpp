@@ -0,0 +1,255 @@
+#include "BulkLoader.h"
+#include <stdexcept>
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <cerrno>
+#include <exception>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace std::chrono;
+
+// Throw a runtime_error naming the failed call and file
+static void ThrowIOError(const string &what, const string &path) {
+    throw runtime_error(what + " " + path + ": " + strerror(errno));
+}
+
+// threads, or one per core when 0
+static unsigned int ThreadsFor(unsigned int threads) {
+    if (threads > 0) return threads;
+    return max(1u, thread::hardware_concurrency());
+}
+
+// Run fn(t) for t in [0, threads) on that many threads, rethrowing the
+// first exception any of them raised
+template <class Fn>
+static void RunThreads(unsigned int threads, Fn fn) {
+    vector<thread> pool;
+    vector<exception_ptr> errors(threads);
+    for (unsigned int t = 0; t < threads; t++) {
+        pool.push_back(thread([&fn, &errors, t]() {
+            try {
+                fn(t);
+            } catch (...) {
+                errors[t] = current_exception();
+            }
+        }));
+    }
+    for (thread &worker : pool) {
+        worker.join();
+    }
+    for (exception_ptr &error : errors) {
+        if (error) rethrow_exception(error);
+    }
+}
+
+// Seconds since start, restarting the clock
+static double Lap(steady_clock::time_point &start) {
+    steady_clock::time_point now = steady_clock::now();
+    double seconds = duration<double>(now - start).count();
+    start = now;
+    return seconds;
+}
+
+// A read-only mapping of a whole file, unmapped when it goes out of scope
+class MappedFile {
+    public:
+        explicit MappedFile(const string &path) {
+            int fd = open(path.c_str(), O_RDONLY);
+            if (fd < 0) ThrowIOError("open", path);
+            struct stat info;
+            if (fstat(fd, &info) != 0) {
+                close(fd);
+                ThrowIOError("fstat", path);
+            }
+            length = info.st_size;
+            if (length > 0) {
+                void *mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (mapped == MAP_FAILED) {
+                    close(fd);
+                    ThrowIOError("mmap", path);
+                }
+                data = static_cast<const char*>(mapped);
+                madvise(mapped, length, MADV_SEQUENTIAL);
+            }
+            close(fd);
+        }
+        ~MappedFile() {
+            if (data != nullptr) munmap(const_cast<char*>(data), length);
+        }
+
+        const char *data = nullptr;
+        size_t length = 0;
+};
+
+static bool IsKeyChar(char c) {
+    return (c >= '0' && c <= '9') || c == '-';
+}
+
+// Parse every key in text[begin, end) onto out
+static void ParseText(const char *text, size_t begin, size_t end, vector<int> &out, const string &path) {
+    const char *p = text + begin;
+    const char *stop = text + end;
+    while (true) {
+        while (p < stop && !IsKeyChar(*p)) p++;
+        if (p >= stop) return;
+
+        const char *token = p;
+        bool negative = *p == '-';
+        if (negative) p++;
+        long long value = 0;
+        const char *digits = p;
+        while (p < stop && *p >= '0' && *p <= '9' && p - digits < 11) {
+            value = value * 10 + (*p - '0');
+            p++;
+        }
+        if (p == digits || (p < stop && IsKeyChar(*p)) || value > (negative ? -(long long)INT_MIN : INT_MAX)) {
+            throw runtime_error("Malformed key '" + string(token, min<size_t>(stop - token, 16)) + "' in " + path);
+        }
+        out.push_back(static_cast<int>(negative ? -value : value));
+    }
+}
+
+// Parse (or copy) the mapped keys in parallel, keeping file order
+static vector<int> ParseKeys(const MappedFile &file, KeyFormat format, unsigned int threads, const string &path) {
+    if (format == KeyFormat::Binary) {
+        if (file.length % sizeof(int) != 0) {
+            throw runtime_error("Binary key file " + path + " is not a whole number of keys");
+        }
+        size_t n = file.length / sizeof(int);
+        vector<int> keys(n);
+        RunThreads(threads, [&](unsigned int t) {
+            size_t begin = n * t / threads;
+            size_t end = n * (t + 1) / threads;
+            if (end > begin) memcpy(&keys[begin], file.data + begin * sizeof(int), (end - begin) * sizeof(int));
+        });
+        return keys;
+    }
+
+    // Cut the text into equal chunks, moving each cut forward past any
+    // key that straddles it; the chunk before owns that key
+    vector<size_t> cuts(threads + 1, file.length);
+    cuts[0] = 0;
+    for (unsigned int t = 1; t < threads; t++) {
+        size_t cut = max(cuts[t - 1], file.length * t / threads);
+        while (cut > 0 && cut < file.length && IsKeyChar(file.data[cut - 1])) cut++;
+        cuts[t] = cut;
+    }
+
+    vector<vector<int> > parts(threads);
+    RunThreads(threads, [&](unsigned int t) {
+        parts[t].reserve((cuts[t + 1] - cuts[t]) / 4);
+        ParseText(file.data, cuts[t], cuts[t + 1], parts[t], path);
+    });
+
+    vector<size_t> offsets(threads + 1, 0);
+    for (unsigned int t = 0; t < threads; t++) {
+        offsets[t + 1] = offsets[t] + parts[t].size();
+    }
+    vector<int> keys(offsets[threads]);
+    RunThreads(threads, [&](unsigned int t) {
+        copy(parts[t].begin(), parts[t].end(), keys.begin() + offsets[t]);
+        vector<int>().swap(parts[t]);
+    });
+    return keys;
+}
+
+// LSD radix sort, one byte per pass. Each thread counts the digits of its
+// own slice; prefix sums over (digit, thread) give every thread its own
+// output ranges, so the scatter needs no locks and stays stable. Keys
+// are sign-flipped so unsigned order matches signed order, and a pass
+// whose byte is the same for every key is skipped.
+void ParallelRadixSort(vector<int> &keys, unsigned int threads) {
+    size_t n = keys.size();
+    if (n < 2) return;
+    threads = ThreadsFor(threads);
+    if (n < threads * 1024) threads = 1;
+
+    vector<unsigned int> a(n), b(n);
+    RunThreads(threads, [&](unsigned int t) {
+        for (size_t i = n * t / threads; i < n * (t + 1) / threads; i++) {
+            a[i] = static_cast<unsigned int>(keys[i]) ^ 0x80000000u;
+        }
+    });
+
+    vector<size_t> counts(threads * 256);
+    for (unsigned int shift = 0; shift < 32; shift += 8) {
+        fill(counts.begin(), counts.end(), 0);
+        RunThreads(threads, [&](unsigned int t) {
+            size_t *mine = &counts[t * 256];
+            for (size_t i = n * t / threads; i < n * (t + 1) / threads; i++) {
+                mine[(a[i] >> shift) & 0xFF]++;
+            }
+        });
+
+        size_t total = 0;
+        bool skip = false;
+        for (unsigned int digit = 0; digit < 256; digit++) {
+            size_t digitStart = total;
+            for (unsigned int t = 0; t < threads; t++) {
+                size_t count = counts[t * 256 + digit];
+                counts[t * 256 + digit] = total;
+                total += count;
+            }
+            if (total - digitStart == n) skip = true;
+        }
+        if (skip) continue;
+
+        RunThreads(threads, [&](unsigned int t) {
+            size_t *next = &counts[t * 256];
+            for (size_t i = n * t / threads; i < n * (t + 1) / threads; i++) {
+                b[next[(a[i] >> shift) & 0xFF]++] = a[i];
+            }
+        });
+        a.swap(b);
+    }
+
+    RunThreads(threads, [&](unsigned int t) {
+        for (size_t i = n * t / threads; i < n * (t + 1) / threads; i++) {
+            keys[i] = static_cast<int>(a[i] ^ 0x80000000u);
+        }
+    });
+}
+
+// Map, parse, sort and deduplicate path's keys
+vector<int> ReadSortedKeys(const string &path, KeyFormat format, unsigned int threads, RBTLoadReport *report) {
+    RBTLoadReport local;
+    if (report == nullptr) report = &local;
+    threads = ThreadsFor(threads);
+    report->threads = threads;
+    steady_clock::time_point clock = steady_clock::now();
+
+    MappedFile file(path);
+    report->bytes = file.length;
+    report->mapSeconds = Lap(clock);
+
+    // Small inputs are not worth the threads
+    unsigned int parsers = max<size_t>(1, min<size_t>(threads, file.length / (1 << 16)));
+    vector<int> keys = ParseKeys(file, format, parsers, path);
+    report->keysRead = keys.size();
+    report->parseSeconds = Lap(clock);
+
+    ParallelRadixSort(keys, threads);
+    report->sortSeconds = Lap(clock);
+
+    keys.erase(unique(keys.begin(), keys.end()), keys.end());
+    report->keysLoaded = keys.size();
+    report->dedupeSeconds = Lap(clock);
+    return keys;
+}
+
+// Replace tree's contents with path's keys
+RBTLoadReport LoadKeyFile(const string &path, RedBlackTree &tree, KeyFormat format, unsigned int threads) {
+    RBTLoadReport report;
+    vector<int> keys = ReadSortedKeys(path, format, threads, &report);
+    steady_clock::time_point clock = steady_clock::now();
+    tree.LoadSorted(keys);
+    report.buildSeconds = Lap(clock);
+    return report;
+}
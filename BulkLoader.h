@@ -0,0 +1,49 @@
+#ifndef BULKLOADER_H
+#define BULKLOADER_H
+
+#include "RedBlackTree.h"
+#include <string>
+#include <vector>
+
+using namespace std;
+
+
+// Key file layouts: decimal text (keys separated by anything that is not
+// a digit or '-'), or raw native-endian 32-bit ints
+enum class KeyFormat {
+	Text,
+	Binary
+};
+
+
+// What a bulk load did and where the time went
+struct RBTLoadReport {
+	size_t bytes = 0;
+	size_t keysRead = 0;
+	size_t keysLoaded = 0;
+	unsigned int threads = 0;
+
+	double mapSeconds = 0;
+	double parseSeconds = 0;
+	double sortSeconds = 0;
+	double dedupeSeconds = 0;
+	double buildSeconds = 0;
+
+	double TotalSeconds() const {return mapSeconds + parseSeconds + sortSeconds + dedupeSeconds + buildSeconds;};
+};
+
+
+// Replace tree's contents with the keys in path. The file is mmapped and
+// parsed in parallel chunks (threads, 0 = one per core), the keys are
+// sorted with a parallel LSD radix sort and deduplicated, and the tree is
+// built from them in linear time with LoadSorted(). Throws runtime_error
+// if the file cannot be read or holds something that is not a key.
+RBTLoadReport LoadKeyFile(const string &path, RedBlackTree &tree, KeyFormat format = KeyFormat::Text, unsigned int threads = 0);
+
+// The parse and sort phases on their own: path's keys, sorted, distinct
+vector<int> ReadSortedKeys(const string &path, KeyFormat format = KeyFormat::Text, unsigned int threads = 0, RBTLoadReport *report = nullptr);
+
+// Sort keys in place with threads (0 = one per core)
+void ParallelRadixSort(vector<int> &keys, unsigned int threads = 0);
+
+#endif
@@ -0,0 +1,233 @@
+#include "CompressedIntSet.h"
+#include <stdexcept>
+#include <algorithm>
+#include <iterator>
+
+using namespace std;
+
+// Longest varint of an unsigned int
+#define MAX_GAP_BYTES 5
+
+// Empty set whose blocks hold up to blockBytes bytes of gaps
+CompressedIntSet::CompressedIntSet(size_t blockBytes) : blockBytes(blockBytes) {
+    if (blockBytes < 8) {
+        throw invalid_argument("Compressed blocks need at least 8 bytes");
+    }
+}
+
+// Write gap to out as a little-endian base-128 varint; returns its length
+size_t CompressedIntSet::EncodeGap(unsigned int gap, unsigned char *out) {
+    size_t len = 0;
+    while (gap >= 0x80) {
+        out[len++] = static_cast<unsigned char>(gap | 0x80);
+        gap >>= 7;
+    }
+    out[len++] = static_cast<unsigned char>(gap);
+    return len;
+}
+
+// Read the varint at in[i], advancing i past it
+unsigned int CompressedIntSet::DecodeGap(const vector<unsigned char> &in, size_t &i) {
+    unsigned int gap = in[i] & 0x7F;
+    unsigned int shift = 7;
+    while (in[i++] & 0x80) {
+        gap |= static_cast<unsigned int>(in[i] & 0x7F) << shift;
+        shift += 7;
+    }
+    return gap;
+}
+
+// Replace gaps[from, to) with bytes[0, len), shifting the tail once
+void CompressedIntSet::Splice(vector<unsigned char> &gaps, size_t from, size_t to, const unsigned char *bytes, size_t len) {
+    size_t old = to - from;
+    if (len > old) gaps.insert(gaps.begin() + to, len - old, 0);
+    else gaps.erase(gaps.begin() + from + len, gaps.begin() + to);
+    copy(bytes, bytes + len, gaps.begin() + from);
+}
+
+// A one-key block with room for a full block and one more splice
+CompressedIntSet::Block CompressedIntSet::NewBlock() const {
+    Block block{1, {}};
+    block.gaps.reserve(blockBytes + 2 * MAX_GAP_BYTES);
+    return block;
+}
+
+// The block that holds (or would hold) data: the one starting at or
+// below it, else the first block. end() when the set is empty.
+CompressedIntSet::BlockIter CompressedIntSet::BlockFor(int data) {
+    BlockIter it = blocks.upper_bound(data);
+    return it == blocks.begin() ? it : prev(it);
+}
+
+// Move the block at it to a new first key, keeping its map node
+CompressedIntSet::BlockIter CompressedIntSet::Rekey(BlockIter it, int first) {
+    map<int, Block>::node_type node = blocks.extract(it);
+    node.key() = first;
+    return blocks.insert(move(node)).position;
+}
+
+// Keep the first keep keys in the block at it and move the rest into a
+// new block starting at the next key
+void CompressedIntSet::Split(BlockIter it, size_t keep) {
+    Block &block = it->second;
+    unsigned int key = static_cast<unsigned int>(it->first);
+    size_t cut = 0;
+    size_t i = 0;
+    for (size_t k = 0; k < keep; k++) {
+        cut = i;
+        key += DecodeGap(block.gaps, i);
+    }
+
+    Block upper = NewBlock();
+    upper.count = block.count - keep;
+    upper.gaps.assign(block.gaps.begin() + i, block.gaps.end());
+    block.gaps.resize(cut);
+    block.count = keep;
+    blocks.emplace_hint(next(it), static_cast<int>(key), move(upper));
+}
+
+// Insert a new key, splicing its gap into its block
+void CompressedIntSet::Insert(int data) {
+    BlockIter it = BlockFor(data);
+    if (it == blocks.end()) {
+        blocks.emplace(data, NewBlock());
+        numItems++;
+        return;
+    }
+    if (data == it->first) {
+        throw invalid_argument("Duplicate value not allowed in CompressedIntSet");
+    }
+
+    Block &block = it->second;
+    unsigned char bytes[2 * MAX_GAP_BYTES];
+    bool appended = false;
+    if (data < it->first) {
+        // New smallest key: it leads the first block
+        size_t len = EncodeGap(static_cast<unsigned int>(it->first) - static_cast<unsigned int>(data), bytes);
+        Splice(block.gaps, 0, 0, bytes, len);
+        it = Rekey(it, data);
+    } else {
+        // Find the gap that steps over data and split it in two
+        unsigned int prev = static_cast<unsigned int>(it->first);
+        size_t i = 0;
+        bool spliced = false;
+        while (i < block.gaps.size()) {
+            size_t at = i;
+            unsigned int next = prev + DecodeGap(block.gaps, i);
+            if (static_cast<int>(next) == data) {
+                throw invalid_argument("Duplicate value not allowed in CompressedIntSet");
+            }
+            if (static_cast<int>(next) > data) {
+                size_t len = EncodeGap(static_cast<unsigned int>(data) - prev, bytes);
+                len += EncodeGap(next - static_cast<unsigned int>(data), bytes + len);
+                Splice(block.gaps, at, i, bytes, len);
+                spliced = true;
+                break;
+            }
+            prev = next;
+        }
+        if (!spliced) {
+            size_t len = EncodeGap(static_cast<unsigned int>(data) - prev, bytes);
+            block.gaps.insert(block.gaps.end(), bytes, bytes + len);
+            appended = true;
+        }
+    }
+    it->second.count++;
+    numItems++;
+
+    if (it->second.gaps.size() > blockBytes) {
+        Split(it, appended ? it->second.count - 1 : it->second.count / 2);
+    }
+}
+
+// Remove a key, merging the gaps on either side of it; a block left
+// empty goes away
+void CompressedIntSet::Remove(int data) {
+    BlockIter it = BlockFor(data);
+    if (it == blocks.end() || data < it->first) {
+        throw invalid_argument("Value not found in CompressedIntSet");
+    }
+
+    Block &block = it->second;
+    if (data == it->first) {
+        numItems--;
+        if (block.count == 1) {
+            blocks.erase(it);
+            return;
+        }
+        size_t i = 0;
+        unsigned int next = static_cast<unsigned int>(data) + DecodeGap(block.gaps, i);
+        block.gaps.erase(block.gaps.begin(), block.gaps.begin() + i);
+        block.count--;
+        Rekey(it, static_cast<int>(next));
+        return;
+    }
+
+    unsigned int prev = static_cast<unsigned int>(it->first);
+    size_t i = 0;
+    while (i < block.gaps.size()) {
+        size_t at = i;
+        unsigned int curr = prev + DecodeGap(block.gaps, i);
+        if (static_cast<int>(curr) > data) break;
+        if (static_cast<int>(curr) == data) {
+            if (i == block.gaps.size()) {
+                block.gaps.resize(at);
+            } else {
+                size_t end = i;
+                unsigned int next = curr + DecodeGap(block.gaps, end);
+                unsigned char bytes[MAX_GAP_BYTES];
+                Splice(block.gaps, at, end, bytes, EncodeGap(next - prev, bytes));
+            }
+            block.count--;
+            numItems--;
+            return;
+        }
+        prev = curr;
+    }
+    throw invalid_argument("Value not found in CompressedIntSet");
+}
+
+// One descent in the index, then decode gaps until reaching data
+bool CompressedIntSet::Contains(int data) const {
+    map<int, Block>::const_iterator it = blocks.upper_bound(data);
+    if (it == blocks.begin()) return false;
+    --it;
+    if (it->first == data) return true;
+
+    const Block &block = it->second;
+    unsigned int curr = static_cast<unsigned int>(it->first);
+    for (size_t i = 0; i < block.gaps.size(); ) {
+        curr += DecodeGap(block.gaps, i);
+        int key = static_cast<int>(curr);
+        if (key >= data) return key == data;
+    }
+    return false;
+}
+
+// Smallest key: the first block's first key
+int CompressedIntSet::GetMin() const {
+    if (numItems == 0) throw invalid_argument("Set is empty");
+    return blocks.begin()->first;
+}
+
+// Largest key: the end of the last block
+int CompressedIntSet::GetMax() const {
+    if (numItems == 0) throw invalid_argument("Set is empty");
+    const pair<const int, Block> &last = *blocks.rbegin();
+    unsigned int data = static_cast<unsigned int>(last.first);
+    for (size_t i = 0; i < last.second.gaps.size(); ) {
+        data += DecodeGap(last.second.gaps, i);
+    }
+    return static_cast<int>(data);
+}
+
+// Encoded gaps and their spare room, plus per block its index node
+// (colour and three links) holding the key and block header
+size_t CompressedIntSet::MemoryBytes() const {
+    size_t bytes = 0;
+    for (const pair<const int, Block> &entry : blocks) {
+        bytes += entry.second.gaps.capacity();
+        bytes += 4 * sizeof(void*) + sizeof(entry);
+    }
+    return bytes;
+}
@@ -0,0 +1,76 @@
+#ifndef COMPRESSEDINTSET_H
+#define COMPRESSEDINTSET_H
+
+#include <cstddef>
+#include <map>
+#include <vector>
+
+using namespace std;
+
+
+// A memory-dense set of ints. Keys are kept sorted in blocks of up to
+// blockBytes bytes: each block stores the gaps between consecutive keys
+// as varints (1 byte for gaps under 128), so dense ID sets cost a byte or
+// two per key instead of a whole RBTNode. A red-black tree (std::map,
+// whose nodes hold the block right beside its key) indexes the blocks by
+// their first key; a lookup is one descent there, then one block decode.
+// Inserts and removes splice varints in place. A block that outgrows
+// blockBytes splits in half, or hands just the new key to a block of its
+// own when it was appended at the end, so ascending loads fill blocks.
+class CompressedIntSet {
+
+	public:
+		explicit CompressedIntSet(size_t blockBytes = 256);
+
+		void Insert(int data);
+		void Remove(int data);
+		bool Contains(int data) const;
+
+		size_t Size() const {return numItems;};
+		size_t Blocks() const {return blocks.size();};
+		int GetMin() const;
+		int GetMax() const;
+
+		// Approximate heap footprint: encoded gaps (with their spare room)
+		// and the index's nodes
+		size_t MemoryBytes() const;
+
+		// Call fn(key) for each key in order
+		template <class Fn>
+		void ForEach(Fn fn) const {
+			for (const pair<const int, Block> &entry : blocks) {
+				const Block &block = entry.second;
+				unsigned int data = static_cast<unsigned int>(entry.first);
+				fn(entry.first);
+				for (size_t i = 0; i < block.gaps.size(); ) {
+					data += DecodeGap(block.gaps, i);
+					fn(static_cast<int>(data));
+				}
+			}
+		};
+
+	private:
+		// Keys after the first, as varint gaps from the previous key. gaps
+		// reserves room for blockBytes plus one splice, so it never grows.
+		struct Block {
+			size_t count;
+			vector<unsigned char> gaps;
+		};
+		typedef map<int, Block>::iterator BlockIter;
+
+		size_t blockBytes;
+		size_t numItems = 0;
+		map<int, Block> blocks;
+
+		Block NewBlock() const;
+		BlockIter BlockFor(int data);
+		BlockIter Rekey(BlockIter it, int first);
+		void Split(BlockIter it, size_t keep);
+
+		static size_t EncodeGap(unsigned int gap, unsigned char *out);
+		static unsigned int DecodeGap(const vector<unsigned char> &in, size_t &i);
+		static void Splice(vector<unsigned char> &gaps, size_t from, size_t to, const unsigned char *bytes, size_t len);
+
+};
+
+#endif
@@ -0,0 +1,218 @@
+#include "DurableRedBlackTree.h"
+#include <stdexcept>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+#define LOG_OP_INSERT 'I'
+#define LOG_OP_REMOVE 'R'
+#define LOG_RECORD_SIZE 5
+
+static const char CHECKPOINT_MAGIC[4] = {'R', 'B', 'T', 'C'};
+
+// Throw a runtime_error naming the failed call and path
+static void ThrowIOError(const string &what, const string &path) {
+    throw runtime_error(what + " " + path + ": " + strerror(errno));
+}
+
+// Write all of buf, retrying short writes
+static void WriteAll(int fd, const char* buf, size_t len, const string &path) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            ThrowIOError("write", path);
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+// Read the whole file into out; a missing file reads as empty
+static bool ReadFile(const string &path, vector<char> &out) {
+    out.clear();
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        if (errno == ENOENT) return false;
+        ThrowIOError("open", path);
+    }
+    char buf[1 << 16];
+    while (true) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            close(fd);
+            ThrowIOError("read", path);
+        }
+        if (n == 0) break;
+        out.insert(out.end(), buf, buf + n);
+    }
+    close(fd);
+    return true;
+}
+
+// Constructor: Open (or create) the directory's files, recover the tree
+// and start the sync timer
+DurableRedBlackTree::DurableRedBlackTree(const string &directory, size_t groupCommit, chrono::milliseconds maxDelay)
+        : directory(directory), groupCommit(groupCommit > 0 ? groupCommit : 1), maxDelay(maxDelay) {
+    Recover();
+    logFd = open(PathOf("wal").c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (logFd < 0) ThrowIOError("open", PathOf("wal"));
+    if (maxDelay.count() > 0) timer = thread([this]() { RunTimer(); });
+}
+
+// Destructor: Stop the timer, flush the last group and close the log
+DurableRedBlackTree::~DurableRedBlackTree() {
+    {
+        lock_guard<mutex> guard(logLock);
+        closing = true;
+    }
+    logWake.notify_one();
+    if (timer.joinable()) timer.join();
+    try {
+        Sync();
+    } catch (runtime_error &e) { }
+    close(logFd);
+}
+
+// Insert into the tree, then log it (duplicates throw before logging)
+void DurableRedBlackTree::Insert(int newData) {
+    tree.Insert(newData);
+    Append(LOG_OP_INSERT, newData);
+}
+
+// Remove from the tree, then log it (missing keys throw before logging)
+void DurableRedBlackTree::Remove(int data) {
+    tree.Remove(data);
+    Append(LOG_OP_REMOVE, data);
+}
+
+// Queue one record; every groupCommit records share one write and fsync,
+// and the timer syncs a smaller group once it is maxDelay old
+void DurableRedBlackTree::Append(char op, int data) {
+    char record[LOG_RECORD_SIZE];
+    record[0] = op;
+    memcpy(record + 1, &data, sizeof(data));
+
+    unique_lock<mutex> guard(logLock);
+    bool first = unsynced.empty();
+    if (first) unsyncedSince = chrono::steady_clock::now();
+    unsynced.insert(unsynced.end(), record, record + LOG_RECORD_SIZE);
+    logRecords++;
+    if (maxDelay.count() == 0 || unsynced.size() >= groupCommit * LOG_RECORD_SIZE) {
+        SyncLocked();
+    } else if (first) {
+        guard.unlock();
+        logWake.notify_one();
+    }
+}
+
+// Write and fsync every record still waiting
+void DurableRedBlackTree::Sync() {
+    lock_guard<mutex> guard(logLock);
+    SyncLocked();
+}
+
+void DurableRedBlackTree::SyncLocked() {
+    if (unsynced.empty()) return;
+    WriteAll(logFd, unsynced.data(), unsynced.size(), PathOf("wal"));
+    if (fdatasync(logFd) != 0) ThrowIOError("fdatasync", PathOf("wal"));
+    unsynced.clear();
+}
+
+// Timer thread: sync whatever is waiting once its first record is
+// maxDelay old. A failed sync leaves the records queued, so the next
+// Sync() (or group) retries and reports the error to a caller.
+void DurableRedBlackTree::RunTimer() {
+    unique_lock<mutex> guard(logLock);
+    while (!closing) {
+        if (unsynced.empty()) {
+            logWake.wait(guard);
+            continue;
+        }
+        chrono::steady_clock::time_point deadline = unsyncedSince + maxDelay;
+        if (chrono::steady_clock::now() < deadline) {
+            logWake.wait_until(guard, deadline);
+            continue;
+        }
+        try {
+            SyncLocked();
+        } catch (runtime_error &e) {
+            logWake.wait_for(guard, maxDelay);
+        }
+    }
+}
+
+// Write the whole tree (sorted) to a new checkpoint, atomically replace
+// the old one, then empty the log. A crash between the rename and the
+// truncate only means the log is replayed again, which is harmless.
+void DurableRedBlackTree::Checkpoint() {
+    lock_guard<mutex> guard(logLock);
+    SyncLocked();
+
+    vector<char> out(CHECKPOINT_MAGIC, CHECKPOINT_MAGIC + sizeof(CHECKPOINT_MAGIC));
+    unsigned long long count = tree.Size();
+    out.insert(out.end(), reinterpret_cast<char*>(&count), reinterpret_cast<char*>(&count) + sizeof(count));
+    out.reserve(out.size() + count * sizeof(int));
+    tree.ForEach([&out](int data) {
+        out.insert(out.end(), reinterpret_cast<char*>(&data), reinterpret_cast<char*>(&data) + sizeof(data));
+    });
+
+    string tmpPath = PathOf("checkpoint.tmp");
+    int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) ThrowIOError("open", tmpPath);
+    WriteAll(fd, out.data(), out.size(), tmpPath);
+    if (fsync(fd) != 0) ThrowIOError("fsync", tmpPath);
+    close(fd);
+    if (rename(tmpPath.c_str(), PathOf("checkpoint").c_str()) != 0) ThrowIOError("rename", tmpPath);
+
+    // Make the rename itself durable
+    int dirFd = open(directory.c_str(), O_RDONLY);
+    if (dirFd >= 0) {
+        fsync(dirFd);
+        close(dirFd);
+    }
+
+    if (ftruncate(logFd, 0) != 0) ThrowIOError("ftruncate", PathOf("wal"));
+    if (fdatasync(logFd) != 0) ThrowIOError("fdatasync", PathOf("wal"));
+    logRecords = 0;
+}
+
+// Load the checkpoint in linear time, then replay the log tail. Replay is
+// idempotent so records already in the checkpoint are skipped, and a torn
+// record at the end of the log is ignored.
+void DurableRedBlackTree::Recover() {
+    vector<char> data;
+    if (ReadFile(PathOf("checkpoint"), data)) {
+        size_t header = sizeof(CHECKPOINT_MAGIC) + sizeof(unsigned long long);
+        unsigned long long count = 0;
+        if (data.size() >= header) memcpy(&count, data.data() + sizeof(CHECKPOINT_MAGIC), sizeof(count));
+        if (data.size() < header || memcmp(data.data(), CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != 0
+                || data.size() != header + count * sizeof(int)) {
+            throw runtime_error("Corrupt checkpoint " + PathOf("checkpoint"));
+        }
+        vector<int> keys(count);
+        memcpy(keys.data(), data.data() + header, count * sizeof(int));
+        tree.LoadSorted(keys);
+    }
+
+    logRecords = 0;
+    if (ReadFile(PathOf("wal"), data)) {
+        for (size_t i = 0; i + LOG_RECORD_SIZE <= data.size(); i += LOG_RECORD_SIZE) {
+            int key;
+            memcpy(&key, &data[i + 1], sizeof(key));
+            if (data[i] == LOG_OP_INSERT && !tree.Contains(key)) tree.Insert(key);
+            else if (data[i] == LOG_OP_REMOVE && tree.Contains(key)) tree.Remove(key);
+            logRecords++;
+        }
+
+        // Cut the torn record off so new appends stay aligned
+        if (data.size() % LOG_RECORD_SIZE != 0 && truncate(PathOf("wal").c_str(), logRecords * LOG_RECORD_SIZE) != 0) {
+            ThrowIOError("truncate", PathOf("wal"));
+        }
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef DURABLEREDBLACKTREE_H
+#define DURABLEREDBLACKTREE_H
+
+#include "RedBlackTree.h"
+#include <string>
+#include <vector>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+using namespace std;
+
+
+// A RedBlackTree backed by files in a directory:
+//   checkpoint - every key in sorted order, written by Checkpoint()
+//   wal        - append-only log of Insert/Remove records since then
+// Records are 5 bytes (op + key). They are written and fsynced in groups
+// of groupCommit, or by a background timer once the oldest waiting record
+// is maxDelay old, whichever comes first. Insert and Remove return before
+// their record is durable; it is once maxDelay has passed (so a crash
+// loses at most the last maxDelay of writes), or as soon as Sync()
+// returns. A maxDelay of zero syncs every record before returning.
+// Opening the directory recovers the tree: the checkpoint is loaded with
+// LoadSorted() and the log tail is replayed on top.
+class DurableRedBlackTree {
+
+	public:
+		DurableRedBlackTree(const string &directory, size_t groupCommit = 64,
+			chrono::milliseconds maxDelay = chrono::milliseconds(10));
+		~DurableRedBlackTree();
+
+		DurableRedBlackTree(const DurableRedBlackTree &drbt) = delete;
+		DurableRedBlackTree &operator=(const DurableRedBlackTree &drbt) = delete;
+
+		void Insert(int newData);
+		void Remove(int data);
+
+		// Commit point: write and fsync every record still waiting
+		void Sync();
+
+		// Write the whole tree to a new checkpoint and empty the log
+		void Checkpoint();
+
+		const RedBlackTree &Tree() const {return tree;};
+		size_t LogRecords() const {return logRecords;};
+
+	private:
+		RedBlackTree tree;
+		string directory;
+		size_t groupCommit;
+		chrono::milliseconds maxDelay;
+
+		int logFd = -1;
+		size_t logRecords = 0;
+
+		// Records waiting for a sync, guarded by logLock and flushed by
+		// the timer thread once the first of them is maxDelay old
+		mutex logLock;
+		condition_variable logWake;
+		vector<char> unsynced;
+		chrono::steady_clock::time_point unsyncedSince;
+		bool closing = false;
+		thread timer;
+
+		void Append(char op, int data);
+		void SyncLocked();
+		void RunTimer();
+		void Recover();
+
+		string PathOf(const string &name) const {return directory + "/" + name;};
+
+};
+
+#endif
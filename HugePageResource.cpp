@@ -0,0 +1,171 @@
+#include "HugePageResource.h"
+#include <stdexcept>
+#include <fstream>
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <linux/mempolicy.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Round n up to a multiple of unit (a power of two)
+static size_t RoundUp(size_t n, size_t unit) {
+    return (n + unit - 1) & ~(unit - 1);
+}
+
+// Map arenas of arenaBytes placed according to policy
+HugePageResource::HugePageResource(size_t arenaBytes, NumaPolicy policy, int node) :
+        arenaBytes(RoundUp(arenaBytes == 0 ? HugePageSize : arenaBytes, HugePageSize)), policy(policy), node(node) {
+    if (policy == NumaPolicy::Bind && (node < 0 || node >= NumaNodes())) {
+        throw invalid_argument("NUMA node " + to_string(node) + " is not online");
+    }
+}
+
+// Unmap every arena; blocks still handed out become invalid
+HugePageResource::~HugePageResource() {
+    for (Arena &arena : arenas) {
+        munmap(arena.base, arena.length);
+    }
+}
+
+// Number of online NUMA nodes, from the highest id in the sysfs node list
+// (e.g. "0-1" or "0,2-3"); 1 when there is no such list
+int HugePageResource::NumaNodes() {
+    ifstream online("/sys/devices/system/node/online");
+    string list;
+    if (!(online >> list)) return 1;
+
+    int highest = 0;
+    int value = 0;
+    for (char c : list) {
+        if (c >= '0' && c <= '9') {
+            value = value * 10 + (c - '0');
+        } else {
+            highest = max(highest, value);
+            value = 0;
+        }
+    }
+    return max(highest, value) + 1;
+}
+
+size_t HugePageResource::Arenas() const {
+    lock_guard<mutex> guard(lock);
+    return arenas.size();
+}
+
+size_t HugePageResource::BytesMapped() const {
+    lock_guard<mutex> guard(lock);
+    size_t total = 0;
+    for (const Arena &arena : arenas) {
+        total += arena.length;
+    }
+    return total;
+}
+
+size_t HugePageResource::HugeTLBArenas() const {
+    lock_guard<mutex> guard(lock);
+    size_t total = 0;
+    for (const Arena &arena : arenas) {
+        if (arena.hugeTLB) total++;
+    }
+    return total;
+}
+
+// Blocks are pooled by size rounded up to their alignment (at least a
+// pointer, so a free block can hold the free-list link)
+size_t HugePageResource::SizeClass(size_t bytes, size_t alignment) {
+    alignment = max(alignment, alignof(void*));
+    return RoundUp(max(bytes, sizeof(void*)), alignment);
+}
+
+// Reuse a freed block of the same size, else bump-allocate from the
+// current arena, mapping a new one when it runs out
+void *HugePageResource::do_allocate(size_t bytes, size_t alignment) {
+    size_t size = SizeClass(bytes, alignment);
+    lock_guard<mutex> guard(lock);
+
+    auto found = freeLists.find(size);
+    if (found != freeLists.end() && found->second != nullptr) {
+        void *block = found->second;
+        found->second = *static_cast<void**>(block);
+        return block;
+    }
+
+    char *start = reinterpret_cast<char*>(RoundUp(reinterpret_cast<uintptr_t>(next), max(alignment, alignof(void*))));
+    if (next == nullptr || start + size > end) {
+        MapArena(size + alignment);
+        start = reinterpret_cast<char*>(RoundUp(reinterpret_cast<uintptr_t>(next), max(alignment, alignof(void*))));
+    }
+    next = start + size;
+    return start;
+}
+
+// Push the block onto its size's free list
+void HugePageResource::do_deallocate(void *p, size_t bytes, size_t alignment) {
+    size_t size = SizeClass(bytes, alignment);
+    lock_guard<mutex> guard(lock);
+    void *&head = freeLists[size];
+    *static_cast<void**>(p) = head;
+    head = p;
+}
+
+bool HugePageResource::do_is_equal(const pmr::memory_resource &other) const noexcept {
+    return this == &other;
+}
+
+// Map a fresh arena of at least minimum bytes and make it current. Try
+// reserved huge pages first; without them, take a normal mapping trimmed
+// to 2 MB alignment so transparent huge pages can back all of it.
+void HugePageResource::MapArena(size_t minimum) {
+    size_t length = max(arenaBytes, RoundUp(minimum, HugePageSize));
+
+    void *mapped = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    bool hugeTLB = mapped != MAP_FAILED;
+    if (!hugeTLB) {
+        mapped = mmap(nullptr, length + HugePageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapped == MAP_FAILED) throw bad_alloc();
+
+        char *raw = static_cast<char*>(mapped);
+        char *aligned = reinterpret_cast<char*>(RoundUp(reinterpret_cast<uintptr_t>(raw), HugePageSize));
+        if (aligned > raw) munmap(raw, aligned - raw);
+        size_t tail = (raw + length + HugePageSize) - (aligned + length);
+        if (tail > 0) munmap(aligned + length, tail);
+        mapped = aligned;
+        madvise(mapped, length, MADV_HUGEPAGE);
+    }
+
+    // Place before anything touches the pages, so they fault in where asked
+    Place(static_cast<char*>(mapped), length);
+
+    arenas.push_back({static_cast<char*>(mapped), length, hugeTLB});
+    next = static_cast<char*>(mapped);
+    end = next + length;
+}
+
+// Apply the NUMA policy to a fresh arena
+void HugePageResource::Place(char *base, size_t length) {
+    if (policy == NumaPolicy::Local) return;
+
+    const int bits = 8 * sizeof(unsigned long);
+    int nodes = NumaNodes();
+    vector<unsigned long> mask(nodes / bits + 1, 0);
+    int mode = MPOL_BIND;
+    if (policy == NumaPolicy::Bind) {
+        mask[node / bits] |= 1UL << (node % bits);
+    } else {
+        mode = MPOL_INTERLEAVE;
+        for (int n = 0; n < nodes; n++) {
+            mask[n / bits] |= 1UL << (n % bits);
+        }
+    }
+
+    if (syscall(SYS_mbind, base, length, mode, mask.data(), mask.size() * bits, 0) != 0) {
+        int error = errno;
+        munmap(base, length);
+        throw runtime_error(string("mbind: ") + strerror(error));
+    }
+}
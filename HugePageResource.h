@@ -0,0 +1,78 @@
+#ifndef HUGEPAGERESOURCE_H
+#define HUGEPAGERESOURCE_H
+
+#include <memory_resource>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+
+// Where a HugePageResource's arenas live on a multi-socket machine
+enum class NumaPolicy {
+	Local,			// First-touch default: the node of the allocating thread
+	Bind,			// Only the given node
+	Interleave		// Round-robin pages across every online node
+};
+
+
+// A memory resource for RedBlackTree nodes that carves them out of large
+// arenas backed by 2 MB huge pages, so a big tree needs far fewer TLB
+// entries. Arenas come from mmap(MAP_HUGETLB) when the kernel has huge
+// pages reserved, and otherwise from ordinary 2 MB-aligned mappings
+// advised with MADV_HUGEPAGE for transparent huge pages. Each arena can
+// be bound to one NUMA node or interleaved across all of them.
+//
+// Freed blocks are kept on per-size free lists and reused; memory only
+// goes back to the kernel when the resource is destroyed, so it must
+// outlive every tree using it. Allocation is guarded by a mutex, so
+// several trees (or concurrent copies) may share one resource.
+class HugePageResource : public pmr::memory_resource {
+
+	public:
+		static const size_t HugePageSize = 2 * 1024 * 1024;
+
+		// Map arenas of arenaBytes (rounded up to whole huge pages) placed
+		// according to policy; node is only used by NumaPolicy::Bind
+		explicit HugePageResource(size_t arenaBytes = 32 * HugePageSize, NumaPolicy policy = NumaPolicy::Local, int node = 0);
+		HugePageResource(const HugePageResource &hpr) = delete;
+		HugePageResource &operator=(const HugePageResource &hpr) = delete;
+		~HugePageResource();
+
+		// Number of online NUMA nodes (1 on non-NUMA machines)
+		static int NumaNodes();
+
+		size_t Arenas() const;
+		size_t BytesMapped() const;
+		// Arenas that got explicit MAP_HUGETLB pages rather than THP advice
+		size_t HugeTLBArenas() const;
+
+	private:
+		struct Arena {
+			char *base;
+			size_t length;
+			bool hugeTLB;
+		};
+
+		size_t arenaBytes;
+		NumaPolicy policy;
+		int node;
+
+		mutable mutex lock;
+		vector<Arena> arenas;
+		char *next = nullptr;
+		char *end = nullptr;
+		unordered_map<size_t, void*> freeLists;
+
+		void *do_allocate(size_t bytes, size_t alignment) override;
+		void do_deallocate(void *p, size_t bytes, size_t alignment) override;
+		bool do_is_equal(const pmr::memory_resource &other) const noexcept override;
+
+		void MapArena(size_t minimum);
+		void Place(char *base, size_t length);
+		static size_t SizeClass(size_t bytes, size_t alignment);
+
+};
+
+#endif
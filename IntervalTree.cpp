@@ -0,0 +1,100 @@
+#include "IntervalTree.h"
+#include <stdexcept>
+#include <algorithm>
+
+using namespace std;
+
+// Constructor: Initialize an empty Interval Tree
+IntervalTree::IntervalTree() : RedBlackTree() {
+}
+
+// Copy Constructor: Create a deep copy of an existing Interval Tree
+IntervalTree::IntervalTree(const IntervalTree &it) : RedBlackTree() {
+    root = CopyOf(static_cast<const IntervalNode*>(it.root));
+    numItems = it.numItems;
+    totalItems = it.totalItems;
+}
+
+// Destructor: Free the nodes here, since only this class knows their type
+IntervalTree::~IntervalTree() {
+    FreeTree(static_cast<IntervalNode*>(root));
+    root = nullptr;
+}
+
+// Insert the closed interval [low, high]. Intervals may share a low end.
+void IntervalTree::Insert(int low, int high) {
+    if (low > high) {
+        throw invalid_argument("Interval low end is above its high end");
+    }
+
+    IntervalNode* node = new IntervalNode;
+    node->data = low;
+    node->color = COLOR_RED;
+    node->high = high;
+    node->maxHigh = high;
+    node->hash = KeyHash(low);
+    InsertNode(node);
+    numItems++;
+    totalItems++;
+
+    // Rotations already recomputed the nodes they moved from their children;
+    // the new interval still has to reach every subtree that now holds it
+    for (RBTNode* n = node->parent; n != nullptr; n = n->parent) {
+        IntervalNode* in = static_cast<IntervalNode*>(n);
+        if (in->maxHigh < high) in->maxHigh = high;
+    }
+}
+
+// Collect the intervals in the subtree at n that overlap [low, high]
+void IntervalTree::Overlapping(const IntervalNode* n, int low, int high, vector<pair<int, int> > &out) {
+    // Nothing below n reaches up to low
+    if (n == nullptr || n->maxHigh < low) return;
+
+    Overlapping(static_cast<const IntervalNode*>(n->left), low, high, out);
+
+    // n and everything to its right start after high
+    if (n->data > high) return;
+
+    if (n->high >= low) out.push_back(make_pair(n->data, n->high));
+    Overlapping(static_cast<const IntervalNode*>(n->right), low, high, out);
+}
+
+// Every stored interval that overlaps [low, high]
+vector<pair<int, int> > IntervalTree::Overlapping(int low, int high) const {
+    vector<pair<int, int> > out;
+    Overlapping(static_cast<const IntervalNode*>(root), low, high, out);
+    return out;
+}
+
+// Recompute a node's maxHigh from its own interval and its children
+void IntervalTree::UpdateAugment(RBTNode* node) {
+    IntervalNode* n = static_cast<IntervalNode*>(node);
+    n->maxHigh = n->high;
+    if (n->left) n->maxHigh = max(n->maxHigh, static_cast<IntervalNode*>(n->left)->maxHigh);
+    if (n->right) n->maxHigh = max(n->maxHigh, static_cast<IntervalNode*>(n->right)->maxHigh);
+}
+
+// Deep copy a subtree rooted at node
+IntervalNode* IntervalTree::CopyOf(const IntervalNode* node) {
+    if (!node) return nullptr;
+    IntervalNode* newNode = new IntervalNode;
+    newNode->data = node->data;
+    newNode->color = node->color;
+    newNode->high = node->high;
+    newNode->maxHigh = node->maxHigh;
+    newNode->count = node->count;
+    newNode->hash = node->hash;
+    newNode->left = CopyOf(static_cast<const IntervalNode*>(node->left));
+    newNode->right = CopyOf(static_cast<const IntervalNode*>(node->right));
+    if (newNode->left) newNode->left->parent = newNode;
+    if (newNode->right) newNode->right->parent = newNode;
+    return newNode;
+}
+
+// Free every node of a subtree
+void IntervalTree::FreeTree(IntervalNode* node) {
+    if (node == nullptr) return;
+    FreeTree(static_cast<IntervalNode*>(node->left));
+    FreeTree(static_cast<IntervalNode*>(node->right));
+    delete node;
+}
@@ -0,0 +1,53 @@
+#ifndef INTERVALTREE_H
+#define INTERVALTREE_H
+
+#include "RedBlackTree.h"
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+
+// Red-black node keyed on the interval's low end (data). maxHigh is the
+// largest high end anywhere in the subtree rooted at this node.
+struct IntervalNode : RBTNode {
+	int high;
+	int maxHigh;
+};
+
+
+// Closed intervals [low, high] kept in a red-black tree. The balancing is
+// RedBlackTree's own; UpdateAugment keeps maxHigh right through rotations.
+class IntervalTree : private RedBlackTree {
+
+	public:
+		IntervalTree();
+		IntervalTree(const IntervalTree &it);
+		~IntervalTree();
+		IntervalTree &operator=(const IntervalTree &it) = delete;
+
+		void Insert(int low, int high);
+
+		// Every stored interval that overlaps the point / range, in order
+		// of low end. O(log n + k) for k results.
+		vector<pair<int, int> > Overlapping(int point) const {return Overlapping(point, point);};
+		vector<pair<int, int> > Overlapping(int low, int high) const;
+
+		using RedBlackTree::Size;
+
+		// Nodes print their low end
+		string ToInfixString() const {return RedBlackTree::ToInfixString();};
+		string ToPrefixString() const {return RedBlackTree::ToPrefixString();};
+		string ToPostfixString() const {return RedBlackTree::ToPostfixString();};
+
+	protected:
+		void UpdateAugment(RBTNode *node) override;
+
+	private:
+		static void Overlapping(const IntervalNode *n, int low, int high, vector<pair<int, int> > &out);
+		static IntervalNode *CopyOf(const IntervalNode *node);
+		static void FreeTree(IntervalNode *node);
+
+};
+
+#endif
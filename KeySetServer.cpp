@@ -0,0 +1,368 @@
+#include "KeySetServer.h"
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+using namespace std;
+
+// Throw a runtime_error naming the failed call and socket
+static void ThrowIOError(const string &what, const string &path) {
+    throw runtime_error(what + " " + path + ": " + strerror(errno));
+}
+
+// sockaddr for a socket file path
+static sockaddr_un SocketAddress(const string &path) {
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        throw invalid_argument("Socket path too long: " + path);
+    }
+    memcpy(addr.sun_path, path.c_str(), path.size());
+    return addr;
+}
+
+// Append a reply to out
+static void PutReply(vector<char> &out, bool ok, int value) {
+    char reply[KeySetReplyBytes];
+    reply[0] = ok ? 1 : 0;
+    memcpy(reply + 1, &value, sizeof(value));
+    out.insert(out.end(), reply, reply + KeySetReplyBytes);
+}
+
+// Bind and listen on socketPath
+KeySetServer::KeySetServer(const string &socketPath, RedBlackTree &tree) : socketPath(socketPath), tree(tree), requests(0) {
+    sockaddr_un addr = SocketAddress(socketPath);
+    listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listenFd < 0) ThrowIOError("socket", socketPath);
+    unlink(socketPath.c_str());
+    if (bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(listenFd, 128) != 0) {
+        close(listenFd);
+        ThrowIOError("bind", socketPath);
+    }
+
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    stopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epollFd < 0 || stopFd < 0) {
+        close(listenFd);
+        ThrowIOError("epoll", socketPath);
+    }
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = listenFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &ev);
+    ev.data.fd = stopFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, stopFd, &ev);
+}
+
+// Close every connection and remove the socket file
+KeySetServer::~KeySetServer() {
+    for (pair<const int, Connection> &entry : connections) close(entry.first);
+    close(listenFd);
+    close(epollFd);
+    close(stopFd);
+    unlink(socketPath.c_str());
+}
+
+// Event loop: accept, read and answer, flush replies, until Stop()
+void KeySetServer::Run() {
+    epoll_event events[64];
+    while (true) {
+        int ready = epoll_wait(epollFd, events, 64, -1);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            ThrowIOError("epoll_wait", socketPath);
+        }
+        for (int i = 0; i < ready; i++) {
+            int fd = events[i].data.fd;
+            if (fd == stopFd) {
+                uint64_t ignored;
+                if (read(stopFd, &ignored, sizeof(ignored)) < 0) { }
+                return;
+            }
+            if (fd == listenFd) {
+                Accept();
+                continue;
+            }
+
+            unordered_map<int, Connection>::iterator found = connections.find(fd);
+            if (found == connections.end()) continue;
+            Connection &conn = found->second;
+            bool open = true;
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) open = Read(fd, conn);
+            // Draining a full backlog lets the requests held back go on
+            while (open) {
+                bool full = Backlog(conn) >= KeySetMaxBacklog;
+                open = Write(fd, conn);
+                if (!open || !full || Backlog(conn) >= KeySetMaxBacklog) break;
+                open = Read(fd, conn);
+            }
+            if (!open) Close(fd);
+        }
+    }
+}
+
+// Wake Run() up and make it return; safe from any thread
+void KeySetServer::Stop() {
+    uint64_t one = 1;
+    if (write(stopFd, &one, sizeof(one)) < 0) { }
+}
+
+// Take every pending connection
+void KeySetServer::Accept() {
+    while (true) {
+        int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) return;
+        epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev);
+        Connection conn;
+        conn.watching = EPOLLIN;
+        connections[fd] = conn;
+    }
+}
+
+// Drain the socket, answering complete requests as they arrive, until
+// the reply backlog is full. False once the peer has gone or sent
+// garbage.
+bool KeySetServer::Read(int fd, Connection &conn) {
+    char buf[64 * 1024];
+    while (true) {
+        if (!Answer(conn)) return false;
+        if (Backlog(conn) >= KeySetMaxBacklog) return true;
+        ssize_t got = read(fd, buf, sizeof(buf));
+        if (got > 0) {
+            conn.in.insert(conn.in.end(), buf, buf + got);
+            continue;
+        }
+        if (got == 0) return false;
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    }
+}
+
+// Answer complete requests in conn.in, appending replies to conn.out,
+// until the backlog is full; the rest wait in conn.in
+bool KeySetServer::Answer(Connection &conn) {
+    size_t at = 0;
+    for (; at + KeySetRequestBytes <= conn.in.size() && Backlog(conn) < KeySetMaxBacklog; at += KeySetRequestBytes) {
+        const char *request = conn.in.data() + at;
+        KeySetOp op = static_cast<KeySetOp>(request[0]);
+        int key;
+        unsigned int count;
+        memcpy(&key, request + 1, sizeof(key));
+        memcpy(&count, request + 5, sizeof(count));
+        requests++;
+
+        switch (op) {
+            case KeySetOp::Insert: {
+                // A bounded tree may evict the new key straight away
+                bool added = false;
+                if (!tree.Contains(key)) {
+                    tree.Insert(key);
+                    added = tree.Contains(key);
+                }
+                PutReply(conn.out, added, key);
+                break;
+            }
+            case KeySetOp::Remove: {
+                bool removed = tree.Contains(key);
+                if (removed) tree.Remove(key);
+                PutReply(conn.out, removed, key);
+                break;
+            }
+            case KeySetOp::Contains:
+                PutReply(conn.out, tree.Contains(key), key);
+                break;
+            case KeySetOp::Min:
+            case KeySetOp::Max: {
+                bool any = tree.Size() > 0;
+                PutReply(conn.out, any, any ? (op == KeySetOp::Min ? tree.GetMin() : tree.GetMax()) : 0);
+                break;
+            }
+            case KeySetOp::Range: {
+                count = min(count, KeySetMaxRange);
+                int keys[KeySetMaxRange];
+                size_t found = 0;
+                if (count > 0 && tree.Ceiling(key, keys[0])) {
+                    found = 1 + tree.NextK(keys[0], count - 1, keys + 1);
+                }
+                PutReply(conn.out, true, static_cast<int>(found));
+                const char *bytes = reinterpret_cast<const char*>(keys);
+                conn.out.insert(conn.out.end(), bytes, bytes + found * sizeof(int));
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+    conn.in.erase(conn.in.begin(), conn.in.begin() + at);
+    return true;
+}
+
+// Send as much of conn.out as the socket takes
+bool KeySetServer::Write(int fd, Connection &conn) {
+    while (conn.sent < conn.out.size()) {
+        ssize_t put = send(fd, conn.out.data() + conn.sent, conn.out.size() - conn.sent, MSG_NOSIGNAL);
+        if (put < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) return false;
+            break;
+        }
+        conn.sent += put;
+    }
+    if (conn.sent == conn.out.size()) {
+        conn.out.clear();
+        conn.sent = 0;
+    } else if (conn.sent >= KeySetMaxBacklog) {
+        // Don't let the sent prefix grow while the client reads slowly
+        conn.out.erase(conn.out.begin(), conn.out.begin() + conn.sent);
+        conn.sent = 0;
+    }
+    Watch(fd, conn);
+    return true;
+}
+
+// Watch for requests while the backlog has room, and for writability
+// while replies are left over
+void KeySetServer::Watch(int fd, Connection &conn) {
+    unsigned int events = 0;
+    if (Backlog(conn) < KeySetMaxBacklog) events |= EPOLLIN;
+    if (Backlog(conn) > 0) events |= EPOLLOUT;
+    if (events == conn.watching) return;
+    epoll_event ev = {};
+    ev.events = events;
+    ev.data.fd = fd;
+    epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &ev);
+    conn.watching = events;
+}
+
+void KeySetServer::Close(int fd) {
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    connections.erase(fd);
+}
+
+// Connect to a server listening on socketPath
+KeySetClient::KeySetClient(const string &socketPath) {
+    sockaddr_un addr = SocketAddress(socketPath);
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) ThrowIOError("socket", socketPath);
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        close(fd);
+        ThrowIOError("connect", socketPath);
+    }
+}
+
+KeySetClient::~KeySetClient() {
+    close(fd);
+}
+
+// Add a request to the next Flush()
+void KeySetClient::Queue(KeySetOp op, int key, unsigned int count) {
+    char request[KeySetRequestBytes];
+    request[0] = static_cast<char>(op);
+    memcpy(request + 1, &key, sizeof(key));
+    memcpy(request + 5, &count, sizeof(count));
+    outgoing.insert(outgoing.end(), request, request + KeySetRequestBytes);
+    queuedOps.push_back(op);
+}
+
+// Send the queued requests and read their replies in order. Requests go
+// in slices whose largest possible replies fit the server's backlog, so
+// the server never stops reading while this end is still writing.
+vector<KeySetReply> KeySetClient::Flush() {
+    vector<KeySetReply> replies(queuedOps.size());
+    for (size_t first = 0; first < queuedOps.size(); ) {
+        size_t last = first;
+        size_t replyBytes = 0;
+        while (last < queuedOps.size()) {
+            size_t bytes = KeySetReplyBytes;
+            if (queuedOps[last] == KeySetOp::Range) {
+                unsigned int count;
+                memcpy(&count, outgoing.data() + last * KeySetRequestBytes + 5, sizeof(count));
+                bytes += min(count, KeySetMaxRange) * sizeof(int);
+            }
+            if (last > first && replyBytes + bytes > KeySetMaxBacklog) break;
+            replyBytes += bytes;
+            last++;
+        }
+
+        size_t end = last * KeySetRequestBytes;
+        for (size_t sent = first * KeySetRequestBytes; sent < end; ) {
+            ssize_t put = write(fd, outgoing.data() + sent, end - sent);
+            if (put < 0) {
+                if (errno == EINTR) continue;
+                throw runtime_error(string("Key set server write: ") + strerror(errno));
+            }
+            sent += put;
+        }
+
+        for (size_t i = first; i < last; i++) {
+            char reply[KeySetReplyBytes];
+            ReadFully(reply, KeySetReplyBytes);
+            replies[i].ok = reply[0] != 0;
+            memcpy(&replies[i].value, reply + 1, sizeof(int));
+            if (queuedOps[i] == KeySetOp::Range) {
+                replies[i].keys.resize(replies[i].value);
+                ReadFully(reinterpret_cast<char*>(replies[i].keys.data()), replies[i].keys.size() * sizeof(int));
+            }
+        }
+        first = last;
+    }
+    outgoing.clear();
+    queuedOps.clear();
+    return replies;
+}
+
+// Block until len bytes have arrived
+void KeySetClient::ReadFully(char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t got = read(fd, buf, len);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) throw runtime_error("Key set server closed the connection");
+        buf += got;
+        len -= got;
+    }
+}
+
+// A single request on its own round trip; anything already queued goes too
+KeySetReply KeySetClient::One(KeySetOp op, int key, unsigned int count) {
+    Queue(op, key, count);
+    return Flush().back();
+}
+
+bool KeySetClient::Insert(int data) {
+    return One(KeySetOp::Insert, data).ok;
+}
+
+bool KeySetClient::Remove(int data) {
+    return One(KeySetOp::Remove, data).ok;
+}
+
+bool KeySetClient::Contains(int data) {
+    return One(KeySetOp::Contains, data).ok;
+}
+
+bool KeySetClient::GetMin(int &out) {
+    KeySetReply reply = One(KeySetOp::Min, 0);
+    if (reply.ok) out = reply.value;
+    return reply.ok;
+}
+
+bool KeySetClient::GetMax(int &out) {
+    KeySetReply reply = One(KeySetOp::Max, 0);
+    if (reply.ok) out = reply.value;
+    return reply.ok;
+}
+
+vector<int> KeySetClient::Range(int low, unsigned int count) {
+    return One(KeySetOp::Range, low, count).keys;
+}
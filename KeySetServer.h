@@ -0,0 +1,124 @@
+#ifndef KEYSETSERVER_H
+#define KEYSETSERVER_H
+
+#include "RedBlackTree.h"
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <atomic>
+
+using namespace std;
+
+
+// Wire protocol, native byte order (the socket never leaves the host).
+// Every request is 9 bytes: op, key, count (count is only used by Range).
+// Every reply is 5 bytes: status (1 = true / found, 0 = false / none)
+// and value; a Range reply's value is the number of keys that follow.
+// Requests on a connection are answered in order, so clients can send
+// many before reading any replies.
+enum class KeySetOp : unsigned char {
+	Insert = 'I',		// status: inserted and kept (0 if already present or evicted)
+	Remove = 'R',		// status: removed (0 if absent)
+	Contains = 'C',
+	Min = 'm',			// value: smallest key
+	Max = 'M',			// value: largest key
+	Range = 'N'			// up to count (at most KeySetMaxRange) keys >= key
+};
+
+static const size_t KeySetRequestBytes = 9;
+static const size_t KeySetReplyBytes = 5;
+static const unsigned int KeySetMaxRange = 4096;
+
+// A server stops reading from a connection once this many bytes of its
+// replies are waiting to be sent, and resumes when the client has read
+// them. KeySetClient::Flush() sends its queue in slices whose replies
+// fit, so a big batch cannot stall both ends.
+static const size_t KeySetMaxBacklog = 1024 * 1024;
+
+
+struct KeySetReply {
+	bool ok = false;
+	int value = 0;
+	vector<int> keys;
+};
+
+
+// Serves one RedBlackTree over a Unix domain socket from a single-threaded
+// epoll loop, so the tree needs no locking. Each wakeup answers the
+// complete requests a connection has sent and writes the replies back
+// together; requests wait while KeySetMaxBacklog bytes of replies do.
+class KeySetServer {
+
+	public:
+		// Bind and listen on socketPath (replacing a stale socket file)
+		KeySetServer(const string &socketPath, RedBlackTree &tree);
+		KeySetServer(const KeySetServer &kss) = delete;
+		KeySetServer &operator=(const KeySetServer &kss) = delete;
+		~KeySetServer();
+
+		// Serve until Stop() is called (from any thread or a signal handler)
+		void Run();
+		void Stop();
+
+		unsigned long long Requests() const {return requests;};
+
+	private:
+		struct Connection {
+			vector<char> in;
+			vector<char> out;
+			size_t sent = 0;
+			unsigned int watching = 0;
+		};
+
+		string socketPath;
+		RedBlackTree &tree;
+		int listenFd = -1;
+		int epollFd = -1;
+		int stopFd = -1;
+		unordered_map<int, Connection> connections;
+		atomic<unsigned long long> requests;
+
+		void Accept();
+		bool Read(int fd, Connection &conn);
+		bool Write(int fd, Connection &conn);
+		bool Answer(Connection &conn);
+		void Watch(int fd, Connection &conn);
+		static size_t Backlog(const Connection &conn) {return conn.out.size() - conn.sent;};
+		void Close(int fd);
+
+};
+
+
+// Blocking client for a KeySetServer. Queue() any number of requests and
+// Flush() sends them in one write and collects the replies in order;
+// the single-request methods are a Queue() and Flush() each.
+class KeySetClient {
+
+	public:
+		explicit KeySetClient(const string &socketPath);
+		KeySetClient(const KeySetClient &ksc) = delete;
+		KeySetClient &operator=(const KeySetClient &ksc) = delete;
+		~KeySetClient();
+
+		void Queue(KeySetOp op, int key = 0, unsigned int count = 0);
+		vector<KeySetReply> Flush();
+		size_t Queued() const {return queuedOps.size();};
+
+		bool Insert(int data);
+		bool Remove(int data);
+		bool Contains(int data);
+		bool GetMin(int &out);
+		bool GetMax(int &out);
+		vector<int> Range(int low, unsigned int count);
+
+	private:
+		int fd = -1;
+		vector<char> outgoing;
+		vector<KeySetOp> queuedOps;
+
+		KeySetReply One(KeySetOp op, int key, unsigned int count = 0);
+		void ReadFully(char *buf, size_t len);
+
+};
+
+#endif
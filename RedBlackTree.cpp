@@ -1,10 +1,188 @@
 #include "RedBlackTree.h"
+#include "RedBlackTreeBalance.h"
 #include <stdexcept>
 #include <sstream>
 #include <cassert>
+#include <cstdint>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <new>
+
+#ifdef RBT_STATS
+#include <atomic>
+#include <mutex>
+#endif
 
 using namespace std;
 
+// Remove starts reclaiming pooled node blocks once more than half their
+// bytes, and at least this many, belong to removed keys; each Remove then
+// moves this many nodes of the compaction pass
+#define RBT_RECLAIM_MIN_BYTES (1 << 20)
+#define RBT_RECLAIM_STEP 16
+
+// Operation counters. Each thread bumps its own block of relaxed atomics
+// (a plain load/store on the owning thread), and Stats() sums every block.
+// Without RBT_STATS all of these macros expand to nothing.
+#ifdef RBT_STATS
+
+namespace {
+
+struct StatsCounters {
+    atomic<unsigned long long> leftRotations{0};
+    atomic<unsigned long long> rightRotations{0};
+    atomic<unsigned long long> fixupRecolor{0};
+    atomic<unsigned long long> fixupLeftLeft{0};
+    atomic<unsigned long long> fixupRightRight{0};
+    atomic<unsigned long long> fixupLeftRight{0};
+    atomic<unsigned long long> fixupRightLeft{0};
+    atomic<unsigned long long> containsDepth[RBT_DEPTH_BUCKETS];
+    atomic<unsigned long long> insertDepth[RBT_DEPTH_BUCKETS];
+    atomic<unsigned long long> nodesAllocated{0};
+    atomic<unsigned long long> treeCopies{0};
+
+    StatsCounters() {
+        for (int i = 0; i < RBT_DEPTH_BUCKETS; i++) {
+            containsDepth[i].store(0, memory_order_relaxed);
+            insertDepth[i].store(0, memory_order_relaxed);
+        }
+    }
+};
+
+// Add (or reset) one counter into a snapshot field
+void Fold(unsigned long long &total, atomic<unsigned long long> &counter, bool reset) {
+    total += counter.load(memory_order_relaxed);
+    if (reset) counter.store(0, memory_order_relaxed);
+}
+
+void FoldAll(RBTStats &total, StatsCounters &c, bool reset) {
+    Fold(total.leftRotations, c.leftRotations, reset);
+    Fold(total.rightRotations, c.rightRotations, reset);
+    Fold(total.fixupRecolor, c.fixupRecolor, reset);
+    Fold(total.fixupLeftLeft, c.fixupLeftLeft, reset);
+    Fold(total.fixupRightRight, c.fixupRightRight, reset);
+    Fold(total.fixupLeftRight, c.fixupLeftRight, reset);
+    Fold(total.fixupRightLeft, c.fixupRightLeft, reset);
+    for (int i = 0; i < RBT_DEPTH_BUCKETS; i++) {
+        Fold(total.containsDepth[i], c.containsDepth[i], reset);
+        Fold(total.insertDepth[i], c.insertDepth[i], reset);
+    }
+    Fold(total.nodesAllocated, c.nodesAllocated, reset);
+    Fold(total.treeCopies, c.treeCopies, reset);
+}
+
+// Live per-thread blocks plus the totals of threads that already exited
+struct StatsRegistry {
+    mutex lock;
+    vector<StatsCounters*> live;
+    RBTStats retired;
+};
+
+StatsRegistry &Registry() {
+    static StatsRegistry registry;
+    return registry;
+}
+
+struct ThreadStats {
+    StatsCounters counters;
+
+    ThreadStats() {
+        StatsRegistry &r = Registry();
+        lock_guard<mutex> guard(r.lock);
+        r.live.push_back(&counters);
+    }
+
+    ~ThreadStats() {
+        StatsRegistry &r = Registry();
+        lock_guard<mutex> guard(r.lock);
+        FoldAll(r.retired, counters, false);
+        for (size_t i = 0; i < r.live.size(); i++) {
+            if (r.live[i] == &counters) {
+                r.live.erase(r.live.begin() + i);
+                break;
+            }
+        }
+    }
+};
+
+thread_local ThreadStats threadStats;
+
+void Bump(atomic<unsigned long long> &counter) {
+    counter.store(counter.load(memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+} // namespace
+
+#define RBT_STATS_ONLY(code) code
+#define RBT_STAT_INC(field) Bump(threadStats.counters.field)
+#define RBT_STAT_DEPTH(field, depth) \
+    Bump(threadStats.counters.field[(depth) < RBT_DEPTH_BUCKETS ? (depth) : RBT_DEPTH_BUCKETS - 1])
+
+#else
+
+#define RBT_STATS_ONLY(code)
+#define RBT_STAT_INC(field)
+#define RBT_STAT_DEPTH(field, depth)
+
+#endif
+
+// RedBlackTree's side of the shared balancing code: pointer links, and
+// rotations that keep the subtree hashes and augments right
+struct RedBlackTree::Links {
+    RedBlackTree &tree;
+
+    static constexpr RBTNode *NONE = nullptr;
+
+    RBTNode *&Left(RBTNode *n) const {return n->left;}
+    RBTNode *&Right(RBTNode *n) const {return n->right;}
+    RBTNode *&Parent(RBTNode *n) const {return n->parent;}
+    unsigned short int &Color(RBTNode *n) const {return n->color;}
+    RBTNode *&Root() const {return tree.root;}
+
+    void Rotated(RBTNode *x, RBTNode *y) const {
+        y->hash = x->hash;
+        x->hash = SubtreeHash(x);
+        tree.UpdateAugment(x);
+        tree.UpdateAugment(y);
+    }
+
+    void Step(RBTStep step) const {
+        switch (step) {
+            case RBTStep::LeftRotate: RBT_STAT_INC(leftRotations); break;
+            case RBTStep::RightRotate: RBT_STAT_INC(rightRotations); break;
+            case RBTStep::Recolor: RBT_STAT_INC(fixupRecolor); break;
+            case RBTStep::LeftLeft: RBT_STAT_INC(fixupLeftLeft); break;
+            case RBTStep::RightRight: RBT_STAT_INC(fixupRightRight); break;
+            case RBTStep::LeftRight: RBT_STAT_INC(fixupLeftRight); break;
+            case RBTStep::RightLeft: RBT_STAT_INC(fixupRightLeft); break;
+        }
+    }
+};
+
+// Snapshot of the operation counters summed over all threads
+RBTStats RedBlackTree::Stats() {
+    RBTStats total;
+#ifdef RBT_STATS
+    StatsRegistry &r = Registry();
+    lock_guard<mutex> guard(r.lock);
+    total = r.retired;
+    for (StatsCounters *c : r.live) FoldAll(total, *c, false);
+#endif
+    return total;
+}
+
+// Zero the operation counters of every thread
+void RedBlackTree::ResetStats() {
+#ifdef RBT_STATS
+    StatsRegistry &r = Registry();
+    lock_guard<mutex> guard(r.lock);
+    r.retired = RBTStats();
+    RBTStats discard;
+    for (StatsCounters *c : r.live) FoldAll(discard, *c, true);
+#endif
+}
+
 // Constructor: Initialize an empty Red-Black Tree
 RedBlackTree::RedBlackTree() {
     root = nullptr;
@@ -13,33 +191,266 @@ RedBlackTree::RedBlackTree() {
 
 // Constructor: Create a Red-Black Tree with a single black root node
 RedBlackTree::RedBlackTree(int newData) {
-    RBTNode* node = new RBTNode;
-    node->data = newData;
-    node->color = COLOR_BLACK;
-    root = node;
+    root = NewNode(newData, COLOR_BLACK);
     numItems = 1;
+    totalItems = 1;
 }
 
-// Copy Constructor: Create a deep copy of an existing Red-Black Tree
-RedBlackTree::RedBlackTree(const RedBlackTree &rbt) {
+// Constructor: Initialize an empty Red-Black Tree whose nodes come from resource
+RedBlackTree::RedBlackTree(pmr::memory_resource *resource, bool freeNodes) : resource(resource), freeNodes(freeNodes) {
+}
+
+// Copy Constructor: Create a deep copy of an existing Red-Black Tree, using
+// the same memory resource
+RedBlackTree::RedBlackTree(const RedBlackTree &rbt) : RedBlackTree(rbt, rbt.resource, rbt.freeNodes) {
+}
+
+// Copy Constructor: Create a deep copy of an existing Red-Black Tree whose
+// nodes come from resource
+RedBlackTree::RedBlackTree(const RedBlackTree &rbt, pmr::memory_resource *resource, bool freeNodes)
+        : resource(resource), freeNodes(freeNodes) {
+    RBT_STAT_INC(treeCopies);
     root = CopyOf(rbt.root);
     numItems = rbt.numItems;
+    totalItems = rbt.totalItems;
+    pending = rbt.pending;
+    pendingCapacity = rbt.pendingCapacity;
+    multiset = rbt.multiset;
+    cache.resize(rbt.cache.size());
+    CopyBloomFilter(rbt);
+    capacity = rbt.capacity;
+    evictMin = rbt.evictMin;
+    boundary = rbt.boundary;
+}
+
+// Destructor: Free every node, unless the resource was said to reclaim
+// them itself, in which case walking the tree would be wasted work
+RedBlackTree::~RedBlackTree() {
+    if (!freeNodes) return;
+    FreeTree(root);
+    FreeBlocks();
+}
+
+// Assignment: Replace this tree with a deep copy of another
+RedBlackTree& RedBlackTree::operator=(const RedBlackTree &rbt) {
+    if (this == &rbt) return *this;
+    RBT_STAT_INC(treeCopies);
+    FreeTree(root);
+    FreeBlocks();
+    root = CopyOf(rbt.root);
+    numItems = rbt.numItems;
+    totalItems = rbt.totalItems;
+    pending = rbt.pending;
+    pendingCapacity = rbt.pendingCapacity;
+    multiset = rbt.multiset;
+    KeysReplaced();
+    CopyBloomFilter(rbt);
+    capacity = rbt.capacity;
+    evictMin = rbt.evictMin;
+    boundary = rbt.boundary;
+    return *this;
+}
+
+// Same keys (and counts) as rbt, whatever the shape
+bool RedBlackTree::operator==(const RedBlackTree &rbt) const {
+    if (numItems != rbt.numItems || totalItems != rbt.totalItems || Hash() != rbt.Hash()) return false;
+
+    // Walk both trees in order side by side
+    MergePending();
+    rbt.MergePending();
+    const RBTNode* a = FirstNode(root);
+    const RBTNode* b = FirstNode(rbt.root);
+    while (a != nullptr && b != nullptr) {
+        if (a->data != b->data || a->count != b->count) return false;
+        a = NextNode(a);
+        b = NextNode(b);
+    }
+    return true;
+}
+
+// Order-independent hash of every key, buffered ones included
+unsigned long long RedBlackTree::Hash() const {
+    unsigned long long h = root ? root->hash : 0;
+    for (int data : pending) h += KeyHash(data);
+    return h;
+}
+
+// Keys whose count is higher in a (onlyInA) or in b (onlyInB)
+void RedBlackTree::Diff(const RedBlackTree &a, const RedBlackTree &b, vector<int> &onlyInA, vector<int> &onlyInB) {
+    a.MergePending();
+    b.MergePending();
+    Diff(a, b, INT_MIN, INT_MAX, onlyInA, onlyInB);
+}
+
+// Bisect [low, high] until each range either hashes the same in both
+// trees (and is skipped) or is a single differing key
+void RedBlackTree::Diff(const RedBlackTree &a, const RedBlackTree &b, long long low, long long high,
+        vector<int> &onlyInA, vector<int> &onlyInB) {
+    if (a.HashBelow(high + 1) - a.HashBelow(low) == b.HashBelow(high + 1) - b.HashBelow(low)) return;
+
+    if (low == high) {
+        RBTNode* inA = a.Get(low);
+        RBTNode* inB = b.Get(low);
+        unsigned int countA = inA ? inA->count : 0;
+        unsigned int countB = inB ? inB->count : 0;
+        if (countA > countB) onlyInA.push_back(low);
+        else if (countB > countA) onlyInB.push_back(low);
+        return;
+    }
+
+    long long mid = low + (high - low) / 2;
+    Diff(a, b, low, mid, onlyInA, onlyInB);
+    Diff(a, b, mid + 1, high, onlyInA, onlyInB);
+}
+
+// Hash of every key below bound, in O(log n) from the subtree hashes
+unsigned long long RedBlackTree::HashBelow(long long bound) const {
+    unsigned long long h = 0;
+    const RBTNode* curr = root;
+    while (curr != nullptr) {
+        if (curr->data < bound) {
+            h += curr->hash - (curr->right ? curr->right->hash : 0);
+            curr = curr->right;
+        } else {
+            curr = curr->left;
+        }
+    }
+    return h;
+}
+
+// Well-mixed 64-bit hash of a key (splitmix64 finalizer)
+unsigned long long RedBlackTree::KeyHash(int data) {
+    unsigned long long h = static_cast<unsigned int>(data) + 0x9E3779B97F4A7C15ULL;
+    h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+    return h ^ (h >> 31);
+}
+
+// A node's own keys plus its children's subtree hashes
+unsigned long long RedBlackTree::SubtreeHash(const RBTNode* node) {
+    unsigned long long h = node->count * KeyHash(node->data);
+    if (node->left) h += node->left->hash;
+    if (node->right) h += node->right->hash;
+    return h;
 }
 
 // Insert a new node into the Red-Black Tree
 void RedBlackTree::Insert(int newData) {
-    if (Contains(newData)) {
+    if (multiset) {
+        KeyChanged(newData);
+        InsertCounted(newData);
+        return;
+    }
+    if (capacity > 0 && numItems >= capacity) {
+        InsertEvicting(newData);
+        return;
+    }
+
+    if (Lookup(newData)) {
+        throw invalid_argument("Duplicate value not allowed in RedBlackTree");
+    }
+    KeyChanged(newData);
+    BloomAdd(newData);
+
+    numItems++;
+    totalItems++;
+    if (pendingCapacity > 0 && capacity == 0) {
+        pending.push_back(newData);
+        if (pending.size() >= pendingCapacity) FlushInsertBuffer();
+        return;
+    }
+
+    InsertNode(NewNode(newData, COLOR_RED));
+    if (capacity > 0) {
+        if (numItems == 1) boundary = newData;
+        else boundary = evictMin ? min(boundary, newData) : max(boundary, newData);
+    }
+}
+
+// Insert into a full bounded tree. Keys past the boundary would be
+// evicted straight away, so they are dropped without a descent; any
+// other key evicts the boundary key and takes over its node. A node in a
+// block retired by a running compaction pass is not reused, since the
+// pass would not move it before freeing the block if its new key sits
+// behind the cursor.
+void RedBlackTree::InsertEvicting(int newData) {
+    if (evictMin ? newData < boundary : newData > boundary) return;
+    if (Lookup(newData)) {
         throw invalid_argument("Duplicate value not allowed in RedBlackTree");
     }
 
-    RBTNode* node = new RBTNode;
-    node->data = newData;
-    node->color = COLOR_RED;
+    // numItems drops for the moment so a filter rebuild counts right
+    RBTNode* node = BoundaryNode();
+    KeyChanged(node->data);
+    RemoveNode(node);
+    numItems--;
+    BloomRemoved();
+
+    if (compacting) {
+        FreeNode(node);
+        node = NewNode(newData, COLOR_RED);
+    } else {
+        bool pooled = node->pooled;
+        node->~RBTNode();
+        new (node) RBTNode;
+        node->pooled = pooled;
+        node->data = newData;
+        node->color = COLOR_RED;
+        node->hash = KeyHash(newData);
+    }
 
+    KeyChanged(newData);
+    BloomAdd(newData);
+    numItems++;
+    InsertNode(node);
+    boundary = BoundaryNode()->data;
+}
+
+// Bound the tree to capacity distinct keys (0 = unbounded). Once full,
+// each insert evicts the minimum (or the maximum, if evictMin is false).
+// A tree already over capacity is trimmed now.
+void RedBlackTree::SetCapacity(size_t capacity, bool evictMin) {
+    if (multiset && capacity > 0) {
+        throw invalid_argument("A multiset tree cannot be bounded");
+    }
+    FlushInsertBuffer();
+    this->capacity = capacity;
+    this->evictMin = evictMin;
+    Trim();
+}
+
+// Evict boundary keys until the tree fits its capacity, then re-cache
+// the boundary
+void RedBlackTree::Trim() {
+    if (capacity == 0) return;
+    while (numItems > capacity) {
+        RBTNode* node = BoundaryNode();
+        KeyChanged(node->data);
+        numItems--;
+        totalItems--;
+        RemoveNode(node);
+        FreeNode(node);
+        BloomRemoved();
+    }
+    if (root != nullptr) boundary = BoundaryNode()->data;
+}
+
+// The key the next eviction takes: the minimum or maximum node
+RBTNode* RedBlackTree::BoundaryNode() const {
+    RBTNode* node = root;
+    if (evictMin) {
+        while (node->left != nullptr) node = node->left;
+    } else {
+        while (node->right != nullptr) node = node->right;
+    }
+    return node;
+}
+
+// Link a new red node into the tree and restore the Red-Black properties
+void RedBlackTree::InsertNode(RBTNode* node) {
     if (root == nullptr) {
         node->color = COLOR_BLACK;
         root = node;
-        numItems++;
         return;
     }
 
@@ -50,17 +461,297 @@ void RedBlackTree::Insert(int newData) {
         InsertFixUp(node);
     }
 
+    root->color = COLOR_BLACK;
+}
+
+// Multiset insert: one descent either finds the key and bumps its count
+// (no allocation, no rebalancing) or ends where the new node goes
+void RedBlackTree::InsertCounted(int newData) {
+    RBTNode* curr = root;
+    RBTNode* parent = nullptr;
+    RBT_STATS_ONLY(unsigned int depth = 0;)
+
+    // Every node on the path gains the key, whether it is found or added
+    unsigned long long h = KeyHash(newData);
+    while (curr != nullptr) {
+        curr->hash += h;
+        if (newData == curr->data) {
+            curr->count++;
+            totalItems++;
+            return;
+        }
+        parent = curr;
+        RBT_STATS_ONLY(depth++;)
+        curr = (newData < curr->data) ? curr->left : curr->right;
+    }
+
+    BloomAdd(newData);
     numItems++;
+    totalItems++;
+    RBTNode* node = NewNode(newData, COLOR_RED);
+    if (parent == nullptr) {
+        node->color = COLOR_BLACK;
+        root = node;
+        return;
+    }
+
+    RBT_STAT_DEPTH(insertDepth, depth);
+    node->parent = parent;
+    if (newData < parent->data) {
+        parent->left = node;
+    } else {
+        parent->right = node;
+    }
+    if (parent->color == COLOR_RED) {
+        InsertFixUp(node);
+    }
     root->color = COLOR_BLACK;
 }
 
+// Turn multiset mode on or off. It can only be turned off while every
+// key is held once.
+void RedBlackTree::SetMultiset(bool enabled) {
+    if (!enabled && totalItems != numItems) {
+        throw invalid_argument("Tree holds duplicate keys");
+    }
+    if (enabled && capacity > 0) {
+        throw invalid_argument("A bounded tree cannot be a multiset");
+    }
+    FlushInsertBuffer();
+    multiset = enabled;
+}
+
+// Number of times data is held (0 or 1 outside multiset mode)
+unsigned int RedBlackTree::Count(int data) const {
+    if (find(pending.begin(), pending.end(), data) != pending.end()) return 1;
+    RBTNode* node = Get(data);
+    return node ? node->count : 0;
+}
+
+// Remove one occurrence of data; in multiset mode the node only goes
+// away once its count reaches zero
+void RedBlackTree::Remove(int data) {
+    pmr::vector<int>::iterator buffered = find(pending.begin(), pending.end(), data);
+    if (buffered != pending.end()) {
+        KeyChanged(data);
+        *buffered = pending.back();
+        pending.pop_back();
+        numItems--;
+        totalItems--;
+        BloomRemoved();
+        return;
+    }
+
+    RBTNode* node = Get(data);
+    if (node == nullptr) {
+        throw invalid_argument("Value not found in RedBlackTree");
+    }
+    KeyChanged(data);
+
+    totalItems--;
+    if (node->count > 1) {
+        node->count--;
+        unsigned long long h = KeyHash(data);
+        for (RBTNode* n = node; n != nullptr; n = n->parent) n->hash -= h;
+        return;
+    }
+
+    numItems--;
+    RemoveNode(node);
+    FreeNode(node);
+    BloomRemoved();
+    if (capacity > 0 && data == boundary && root != nullptr) boundary = BoundaryNode()->data;
+    ReclaimPooled();
+}
+
+// Unlink node from the tree and restore the Red-Black properties
+// (the caller frees it)
+void RedBlackTree::RemoveNode(RBTNode* node) {
+    RBTNode* moved = node;
+    unsigned short int movedColor = moved->color;
+    RBTNode* child;
+    RBTNode* childParent;
+
+    if (node->left == nullptr) {
+        child = node->right;
+        childParent = node->parent;
+        Transplant(node, node->right);
+    } else if (node->right == nullptr) {
+        child = node->left;
+        childParent = node->parent;
+        Transplant(node, node->left);
+    } else {
+        // Two children: the successor takes node's place
+        moved = node->right;
+        while (moved->left != nullptr) moved = moved->left;
+        movedColor = moved->color;
+        child = moved->right;
+
+        if (moved->parent == node) {
+            childParent = moved;
+        } else {
+            childParent = moved->parent;
+            Transplant(moved, moved->right);
+            moved->right = node->right;
+            moved->right->parent = moved;
+        }
+        Transplant(node, moved);
+        moved->left = node->left;
+        moved->left->parent = moved;
+        moved->color = node->color;
+    }
+
+    // Every node above the splice point lost a descendant
+    for (RBTNode* n = childParent; n != nullptr; n = n->parent) {
+        n->hash = SubtreeHash(n);
+        UpdateAugment(n);
+    }
+
+    // Removing a black node leaves one path short a black
+    if (movedColor == COLOR_BLACK) {
+        RemoveFixUp(child, childParent);
+    }
+    node->left = node->right = node->parent = nullptr;
+}
+
+// Put newNode where oldNode hangs from its parent
+void RedBlackTree::Transplant(RBTNode* oldNode, RBTNode* newNode) {
+    if (oldNode->parent == nullptr) root = newNode;
+    else if (oldNode == oldNode->parent->left) oldNode->parent->left = newNode;
+    else oldNode->parent->right = newNode;
+    if (newNode != nullptr) newNode->parent = oldNode->parent;
+}
+
+// Fix violations of Red-Black Tree properties after removal. node carries
+// an extra black; it may be null, so its parent is passed along.
+void RedBlackTree::RemoveFixUp(RBTNode* node, RBTNode* parent) {
+    while (node != root && IsBlack(node)) {
+        if (node == parent->left) {
+            RBTNode* sibling = parent->right;
+            if (!IsBlack(sibling)) {
+                // Case 1: Red sibling -> rotate so the sibling is black
+                sibling->color = COLOR_BLACK;
+                parent->color = COLOR_RED;
+                LeftRotate(parent);
+                sibling = parent->right;
+            }
+            if (IsBlack(sibling->left) && IsBlack(sibling->right)) {
+                // Case 2: Sibling's children are black -> push the extra black up
+                sibling->color = COLOR_RED;
+                node = parent;
+                parent = node->parent;
+            } else {
+                if (IsBlack(sibling->right)) {
+                    // Case 3: Only the near nephew is red -> rotate it outside
+                    sibling->left->color = COLOR_BLACK;
+                    sibling->color = COLOR_RED;
+                    RightRotate(sibling);
+                    sibling = parent->right;
+                }
+                // Case 4: Far nephew is red -> rotate and finish
+                sibling->color = parent->color;
+                parent->color = COLOR_BLACK;
+                sibling->right->color = COLOR_BLACK;
+                LeftRotate(parent);
+                node = root;
+            }
+        } else {
+            RBTNode* sibling = parent->left;
+            if (!IsBlack(sibling)) {
+                sibling->color = COLOR_BLACK;
+                parent->color = COLOR_RED;
+                RightRotate(parent);
+                sibling = parent->left;
+            }
+            if (IsBlack(sibling->left) && IsBlack(sibling->right)) {
+                sibling->color = COLOR_RED;
+                node = parent;
+                parent = node->parent;
+            } else {
+                if (IsBlack(sibling->left)) {
+                    sibling->right->color = COLOR_BLACK;
+                    sibling->color = COLOR_RED;
+                    LeftRotate(sibling);
+                    sibling = parent->left;
+                }
+                sibling->color = parent->color;
+                parent->color = COLOR_BLACK;
+                sibling->left->color = COLOR_BLACK;
+                RightRotate(parent);
+                node = root;
+            }
+        }
+    }
+    if (node != nullptr) node->color = COLOR_BLACK;
+}
+
+// Null children count as black
+bool RedBlackTree::IsBlack(const RBTNode* node) {
+    return node == nullptr || node->color == COLOR_BLACK;
+}
+
+// Turn the insert buffer on (capacity > 0) or off (capacity == 0)
+void RedBlackTree::SetInsertBuffer(size_t capacity) {
+    pendingCapacity = capacity;
+    if (pending.size() >= capacity) FlushInsertBuffer();
+    pending.reserve(capacity);
+}
+
+// Merge every buffered key into the tree. Small batches are inserted one
+// by one in sorted order; once a batch is big enough that m * log2(n)
+// inserts cost more than a linear merge, the tree is rebuilt instead.
+void RedBlackTree::FlushInsertBuffer() {
+    if (pending.empty()) return;
+    sort(pending.begin(), pending.end());
+
+    size_t treeItems = numItems - pending.size();
+    size_t logTree = 1;
+    while ((size_t(1) << logTree) <= treeItems) logTree++;
+
+    if (pending.size() * logTree < treeItems) {
+        for (int data : pending) InsertNode(NewNode(data, COLOR_RED));
+    } else {
+        // Merge the existing nodes (in order) with fresh nodes for the batch
+        pmr::vector<RBTNode*> nodes(resource);
+        nodes.reserve(numItems);
+        pmr::vector<int>::const_iterator next = pending.begin();
+        RBTNode* curr = root;
+        while (curr != nullptr && curr->left != nullptr) curr = curr->left;
+        while (curr != nullptr) {
+            while (next != pending.end() && *next < curr->data) {
+                nodes.push_back(NewNode(*next++, COLOR_RED));
+            }
+            nodes.push_back(curr);
+            if (curr->right != nullptr) {
+                curr = curr->right;
+                while (curr->left != nullptr) curr = curr->left;
+            } else {
+                while (curr->parent != nullptr && curr == curr->parent->right) curr = curr->parent;
+                curr = curr->parent;
+            }
+        }
+        while (next != pending.end()) nodes.push_back(NewNode(*next++, COLOR_RED));
+        Rebuild(nodes);
+    }
+    pending.clear();
+}
+
+// Merge the insert buffer ahead of a read that needs the tree's order or
+// shape. The key set stays the same, so const readers may do it.
+void RedBlackTree::MergePending() const {
+    if (!pending.empty()) const_cast<RedBlackTree*>(this)->FlushInsertBuffer();
+}
+
 // Basic binary search tree insert (no balancing)
 void RedBlackTree::BasicInsert(RBTNode* node) {
     RBTNode* curr = root;
     RBTNode* parent = nullptr;
+    RBT_STATS_ONLY(unsigned int depth = 0;)
 
     while (curr != nullptr) {
         parent = curr;
+        curr->hash += node->hash;
+        RBT_STATS_ONLY(depth++;)
         if (node->data < curr->data) {
             curr = curr->left;
         } else {
@@ -68,6 +759,7 @@ void RedBlackTree::BasicInsert(RBTNode* node) {
         }
     }
 
+    RBT_STAT_DEPTH(insertDepth, depth);
     node->parent = parent;
     if (node->data < parent->data) {
         parent->left = node;
@@ -78,74 +770,314 @@ void RedBlackTree::BasicInsert(RBTNode* node) {
 
 // Fix violations of Red-Black Tree properties after insertion
 void RedBlackTree::InsertFixUp(RBTNode* node) {
-    RBTNode* parent = node->parent;
-    RBTNode* uncle = GetUncle(node);
-    RBTNode* grand_parent = parent->parent;
-
-    if (uncle != nullptr && uncle->color == COLOR_RED) {
-        // Case 1: Uncle is red -> recolor
-        parent->color = COLOR_BLACK;
-        uncle->color = COLOR_BLACK;
-        if (grand_parent != nullptr) {
-            grand_parent->color = COLOR_RED;
-            if (grand_parent->parent != nullptr && grand_parent->parent->color == COLOR_RED) {
-                InsertFixUp(grand_parent);
-            }
-        }
-    } else if (grand_parent != nullptr) {
-        // Uncle is black or null -> rotations needed
-        grand_parent->color = COLOR_RED;
-
-        if (IsLeftChild(node) && IsLeftChild(parent)) {
-            // Left-Left Case
-            RightRotate(grand_parent);
-            parent->color = COLOR_BLACK;
-        } else if (IsRightChild(node) && IsRightChild(parent)) {
-            // Right-Right Case
-            LeftRotate(grand_parent);
-            parent->color = COLOR_BLACK;
-        } else if (IsLeftChild(node) && IsRightChild(parent)) {
-            // Left-Right Case
-            RightRotate(parent);
-            LeftRotate(grand_parent);
-            node->color = COLOR_BLACK;
-            parent->color = COLOR_RED;
-        } else if (IsRightChild(node) && IsLeftChild(parent)) {
-            // Right-Left Case
-            LeftRotate(parent);
-            RightRotate(grand_parent);
-            node->color = COLOR_BLACK;
-            parent->color = COLOR_RED;
-        } else {
-            throw invalid_argument("impossible state!");
-        }
-    }
+    RBTInsertFixUp(Links{*this}, node);
 }
 
 // Check if a given value exists in the tree
 bool RedBlackTree::Contains(int data) const {
+    if (cache.empty()) return Lookup(data);
+
+    CacheSlot &slot = Probe(cache, data);
+    if (slot.state != 0 && slot.data == data) {
+        cacheStats.hits++;
+        return slot.state == 2;
+    }
+    cacheStats.misses++;
+    bool found = Lookup(data);
+    slot = {data, static_cast<unsigned char>(found ? 2 : 1)};
+    return found;
+}
+
+// Contains() without the hot-key cache
+bool RedBlackTree::Lookup(int data) const {
+    if (!MayContain(data)) return false;
+
+    // Branch-free scan so the compiler can vectorize it
+    bool buffered = false;
+    for (size_t i = 0; i < pending.size(); i++) buffered |= (pending[i] == data);
+    if (buffered) return true;
+
     RBTNode* curr = root;
+    RBT_STATS_ONLY(unsigned int depth = 0;)
     while (curr != nullptr) {
-        if (data == curr->data) return true;
+        if (data == curr->data) {
+            RBT_STAT_DEPTH(containsDepth, depth);
+            return true;
+        }
         curr = (data < curr->data) ? curr->left : curr->right;
+        RBT_STATS_ONLY(depth++;)
     }
+    RBT_STAT_DEPTH(containsDepth, depth);
     return false;
 }
 
+// Size the hot-key cache (rounded up to a power of two; 0 turns it off)
+// and start it empty
+void RedBlackTree::SetLookupCache(size_t slots) {
+    size_t size = 0;
+    if (slots > 0) {
+        size = 1;
+        while (size < slots) size <<= 1;
+    }
+    cache.assign(size, CacheSlot{0, 0});
+    cacheStats = RBTCacheStats();
+}
+
+// The slot data maps to in a power-of-two table
+RedBlackTree::CacheSlot &RedBlackTree::Probe(pmr::vector<CacheSlot> &slots, int data) {
+    return slots[KeyHash(data) & (slots.size() - 1)];
+}
+
+// data is about to be added or removed: forget any cached answer for it
+void RedBlackTree::KeyChanged(int data) {
+    version++;
+    if (cache.empty()) return;
+    CacheSlot &slot = Probe(cache, data);
+    if (slot.data == data) slot.state = 0;
+}
+
+// Every key may have changed: empty the whole cache
+void RedBlackTree::KeysReplaced() {
+    version++;
+    fill(cache.begin(), cache.end(), CacheSlot{0, 0});
+}
+
+// Block for a key hash: multiply-shift on the high half
+static size_t BloomBlockIndex(unsigned long long h, size_t blocks) {
+    return static_cast<size_t>(((h >> 32) * blocks) >> 32);
+}
+
+// Bit i of a key within its block, by double hashing the low half
+static unsigned int BloomBit(unsigned long long h, unsigned int i) {
+    unsigned int h1 = static_cast<unsigned int>(h & 0xFFFF);
+    unsigned int h2 = static_cast<unsigned int>((h >> 16) & 0xFFFF) | 1;
+    return (h1 + i * h2) & 511;
+}
+
+// Size the filter for targetFpr within maxBytes and fill it with every key
+void RedBlackTree::EnableBloomFilter(double targetFpr, size_t maxBytes) {
+    if (!(targetFpr > 0 && targetFpr < 1)) {
+        throw invalid_argument("Bloom filter false-positive rate must be between 0 and 1");
+    }
+    if (maxBytes < sizeof(BloomBlock)) {
+        throw invalid_argument("Bloom filter needs at least one 64-byte block");
+    }
+    bloomTargetFpr = targetFpr;
+    bloomMaxBytes = maxBytes;
+    BuildBloomFilter();
+}
+
+void RedBlackTree::DisableBloomFilter() {
+    bloom.clear();
+    bloom.shrink_to_fit();
+    bloomHashes = 0;
+}
+
+// False means data is certainly absent
+bool RedBlackTree::MayContain(int data) const {
+    if (bloom.empty()) return true;
+    unsigned long long h = KeyHash(data);
+    const BloomBlock &block = bloom[BloomBlockIndex(h, bloom.size())];
+    for (unsigned int i = 0; i < bloomHashes; i++) {
+        unsigned int bit = BloomBit(h, i);
+        if ((block.words[bit >> 6] & (1ULL << (bit & 63))) == 0) return false;
+    }
+    return true;
+}
+
+// Expected false-positive rate for the keys added since the last build
+// (removed keys still hold their bits); 1 when the filter is off
+double RedBlackTree::BloomFalsePositiveRate() const {
+    if (bloom.empty()) return 1;
+    double bits = bloom.size() * 512.0;
+    return pow(1 - exp(-(bloomHashes * double(bloomKeys)) / bits), bloomHashes);
+}
+
+// Set data's bits
+void RedBlackTree::BloomSet(int data) {
+    unsigned long long h = KeyHash(data);
+    BloomBlock &block = bloom[BloomBlockIndex(h, bloom.size())];
+    for (unsigned int i = 0; i < bloomHashes; i++) {
+        unsigned int bit = BloomBit(h, i);
+        block.words[bit >> 6] |= 1ULL << (bit & 63);
+    }
+}
+
+// Add a key that is about to join the tree, rebuilding first if the
+// filter has filled past its budget (the rebuild cannot see data yet)
+void RedBlackTree::BloomAdd(int data) {
+    if (bloom.empty()) return;
+    // A rebuild counts the keys already held, so data is counted after it
+    if (bloomKeys + 1 > bloomRebuildAt) BuildBloomFilter();
+    bloomKeys++;
+    BloomSet(data);
+}
+
+// A key left the tree but its bits stay set; once half the filter's keys
+// are stale, rebuilding it from the live keys wins the rate back
+void RedBlackTree::BloomRemoved() {
+    if (bloom.empty()) return;
+    bloomRemoved++;
+    if (bloomRemoved * 2 > bloomKeys && bloomKeys >= 1024) BuildBloomFilter();
+}
+
+// Resize for twice the current keys (within the budget) and refill.
+// bits/key = -ln(p) / ln(2)^2 and hashes = bits/key * ln(2) give the
+// smallest filter for rate p; it is rebuilt once enough keys arrive to
+// double that rate, or once the key count doubles if the budget is tight.
+void RedBlackTree::BuildBloomFilter() {
+    const double ln2 = log(2.0);
+    double bitsPerKey = -log(bloomTargetFpr) / (ln2 * ln2);
+    bloomHashes = static_cast<unsigned int>(min(16.0, max(1.0, round(bitsPerKey * ln2))));
+
+    size_t planned = max<size_t>(2 * numItems, 1024);
+    size_t bytes = min(bloomMaxBytes, static_cast<size_t>(planned * bitsPerKey / 8) + sizeof(BloomBlock));
+    bloom.assign(max<size_t>(bytes / sizeof(BloomBlock), 1), BloomBlock{});
+
+    double bits = bloom.size() * 512.0;
+    double limit = -bits / bloomHashes * log(1 - pow(min(0.5, 2 * bloomTargetFpr), 1.0 / bloomHashes));
+    bloomRebuildAt = max(static_cast<size_t>(limit), 2 * static_cast<size_t>(numItems));
+    bloomRemoved = 0;
+
+    // Walk the nodes directly: ForEach would merge the insert buffer
+    for (const RBTNode* n = FirstNode(root); n != nullptr; n = NextNode(n)) BloomSet(n->data);
+    for (int data : pending) BloomSet(data);
+    bloomKeys = numItems;
+}
+
+// Take rbt's filter settings and bits (the keys are the same)
+void RedBlackTree::CopyBloomFilter(const RedBlackTree &rbt) {
+    bloom = rbt.bloom;
+    bloomHashes = rbt.bloomHashes;
+    bloomTargetFpr = rbt.bloomTargetFpr;
+    bloomMaxBytes = rbt.bloomMaxBytes;
+    bloomKeys = rbt.bloomKeys;
+    bloomRemoved = rbt.bloomRemoved;
+    bloomRebuildAt = rbt.bloomRebuildAt;
+}
+
+// Per-thread cache over tree, starting empty
+RBTLookupCache::RBTLookupCache(const RedBlackTree &tree, size_t slots) : tree(tree), version(tree.Version()) {
+    size_t size = 1;
+    while (size < slots) size <<= 1;
+    this->slots.assign(size, RedBlackTree::CacheSlot{0, 0});
+}
+
+// tree.Contains(data), answered from this thread's slots when possible
+bool RBTLookupCache::Contains(int data) {
+    if (version != tree.Version()) {
+        fill(slots.begin(), slots.end(), RedBlackTree::CacheSlot{0, 0});
+        version = tree.Version();
+    }
+
+    RedBlackTree::CacheSlot &slot = RedBlackTree::Probe(slots, data);
+    if (slot.state != 0 && slot.data == data) {
+        stats.hits++;
+        return slot.state == 2;
+    }
+    stats.misses++;
+    bool found = tree.Lookup(data);
+    slot = {data, static_cast<unsigned char>(found ? 2 : 1)};
+    return found;
+}
+
 // Get minimum value in the tree (leftmost node)
 int RedBlackTree::GetMin() const {
-    if (root == nullptr) throw invalid_argument("Tree is empty");
+    if (numItems == 0) throw invalid_argument("Tree is empty");
+    int buffered = pending.empty() ? INT_MAX : *min_element(pending.begin(), pending.end());
+    if (root == nullptr) return buffered;
     RBTNode* curr = root;
     while (curr->left != nullptr) curr = curr->left;
-    return curr->data;
+    return min(buffered, curr->data);
 }
 
 // Get maximum value in the tree (rightmost node)
 int RedBlackTree::GetMax() const {
-    if (root == nullptr) throw invalid_argument("Tree is empty");
+    if (numItems == 0) throw invalid_argument("Tree is empty");
+    int buffered = pending.empty() ? INT_MIN : *max_element(pending.begin(), pending.end());
+    if (root == nullptr) return buffered;
     RBTNode* curr = root;
     while (curr->right != nullptr) curr = curr->right;
-    return curr->data;
+    return max(buffered, curr->data);
+}
+
+// Largest key <= x
+bool RedBlackTree::Floor(int x, int &out) const {
+    const RBTNode* node = FloorNode(x, true);
+    bool found = node != nullptr;
+    if (found) out = node->data;
+    for (int data : pending) {
+        if (data <= x && (!found || data > out)) {
+            out = data;
+            found = true;
+        }
+    }
+    return found;
+}
+
+// Smallest key >= x
+bool RedBlackTree::Ceiling(int x, int &out) const {
+    const RBTNode* node = CeilingNode(x, true);
+    bool found = node != nullptr;
+    if (found) out = node->data;
+    for (int data : pending) {
+        if (data >= x && (!found || data < out)) {
+            out = data;
+            found = true;
+        }
+    }
+    return found;
+}
+
+// Largest key < x
+bool RedBlackTree::Predecessor(int x, int &out) const {
+    return x != INT_MIN && Floor(x - 1, out);
+}
+
+// Smallest key > x
+bool RedBlackTree::Successor(int x, int &out) const {
+    return x != INT_MAX && Ceiling(x + 1, out);
+}
+
+// Copy up to k keys greater than x, in order, into out
+size_t RedBlackTree::NextK(int x, size_t k, int *out) const {
+    size_t written = 0;
+    if (k == 0) return 0;
+    MergePending();
+    for (const RBTNode* n = CeilingNode(x, false); n != nullptr && written < k; n = NextNode(n)) {
+        out[written++] = n->data;
+    }
+    return written;
+}
+
+// Deepest node on the search path with a key below x (or equal, if inclusive)
+const RBTNode* RedBlackTree::FloorNode(int x, bool inclusive) const {
+    const RBTNode* best = nullptr;
+    const RBTNode* curr = root;
+    while (curr != nullptr) {
+        if (curr->data < x || (inclusive && curr->data == x)) {
+            best = curr;
+            curr = curr->right;
+        } else {
+            curr = curr->left;
+        }
+    }
+    return best;
+}
+
+// Deepest node on the search path with a key above x (or equal, if inclusive)
+const RBTNode* RedBlackTree::CeilingNode(int x, bool inclusive) const {
+    const RBTNode* best = nullptr;
+    const RBTNode* curr = root;
+    while (curr != nullptr) {
+        if (curr->data > x || (inclusive && curr->data == x)) {
+            best = curr;
+            curr = curr->left;
+        } else {
+            curr = curr->right;
+        }
+    }
+    return best;
 }
 
 // Helper to find a node with given value
@@ -158,6 +1090,318 @@ RBTNode* RedBlackTree::Get(int data) const {
     return nullptr;
 }
 
+// Replace the contents with keys (strictly increasing) in O(n)
+void RedBlackTree::LoadSorted(const vector<int> &keys) {
+    for (size_t i = 1; i < keys.size(); i++) {
+        if (keys[i - 1] >= keys[i]) {
+            throw invalid_argument("Keys must be strictly increasing");
+        }
+    }
+
+    FreeTree(root);
+    FreeBlocks();
+    pending.clear();
+
+    // One block holds every node, in key order, as after a compaction pass
+    pmr::vector<RBTNode*> nodes(resource);
+    nodes.reserve(keys.size());
+    if (!keys.empty()) {
+        blockCapacity = blockUsed = keys.size();
+        RBTNode* block = static_cast<RBTNode*>(resource->allocate(blockCapacity * sizeof(RBTNode), alignof(RBTNode)));
+        blocks.push_back(NodeBlock{block, blockCapacity});
+        pooledSlots += blockCapacity;
+        pooledLive += keys.size();
+        for (size_t i = 0; i < keys.size(); i++) {
+            RBTNode* node = new (&block[i]) RBTNode;
+            node->data = keys[i];
+            node->color = COLOR_BLACK;
+            node->hash = KeyHash(keys[i]);
+            node->pooled = true;
+            nodes.push_back(node);
+        }
+    }
+    Rebuild(nodes);
+    numItems = keys.size();
+    totalItems = keys.size();
+    KeysReplaced();
+    if (!bloom.empty()) BuildBloomFilter();
+    Trim();
+}
+
+// Move up to maxNodes nodes into the current pass's blocks, in key order.
+// The pass remembers the last key it moved rather than a node pointer,
+// so inserts and removes between steps are safe: keys added behind the
+// cursor just stay where they are until the next pass.
+bool RedBlackTree::CompactStep(size_t maxNodes) {
+    RBTNode* curr;
+    if (!compacting) {
+        if (root == nullptr) return true;
+        // Start a pass: last pass's blocks retire, one new block fits the tree
+        retiredBlocks.insert(retiredBlocks.end(), blocks.begin(), blocks.end());
+        blocks.clear();
+        blockUsed = blockCapacity = 0;
+        compacting = true;
+        curr = root;
+        while (curr->left != nullptr) curr = curr->left;
+    } else {
+        // First node with a key past the cursor
+        curr = nullptr;
+        for (RBTNode* n = root; n != nullptr; ) {
+            if (n->data > compactCursor) {
+                curr = n;
+                n = n->left;
+            } else {
+                n = n->right;
+            }
+        }
+    }
+
+    for (size_t moved = 0; curr != nullptr && moved < maxNodes; moved++) {
+        curr = Relocate(curr);
+        compactCursor = curr->data;
+        curr = const_cast<RBTNode*>(NextNode(curr));
+    }
+
+    if (curr != nullptr) return false;
+
+    // Every live node from the retired blocks has moved out
+    for (const NodeBlock &block : retiredBlocks) FreeBlock(block);
+    retiredBlocks.clear();
+    compacting = false;
+    return true;
+}
+
+// Run a whole compaction pass
+void RedBlackTree::Compact() {
+    while (!CompactStep(numItems + 1)) { }
+}
+
+// Pooled nodes (bulk-loaded or compacted) are only given back with their
+// whole block. Once removed keys leave most of the blocks' bytes dead,
+// move on a compaction pass a few nodes per call until it finishes.
+void RedBlackTree::ReclaimPooled() {
+    if (root == nullptr) {
+        FreeBlocks();
+        return;
+    }
+    size_t dead = pooledSlots - pooledLive;
+    if (compacting || (dead * sizeof(RBTNode) >= RBT_RECLAIM_MIN_BYTES && dead * 2 > pooledSlots)) {
+        CompactStep(RBT_RECLAIM_STEP);
+    }
+}
+
+// Copy node into the next free slot of the current block and repoint its
+// parent and children at the copy
+RBTNode* RedBlackTree::Relocate(RBTNode* node) {
+    if (blockUsed == blockCapacity) {
+        // The first block of a pass fits the whole tree; later ones only
+        // hold keys inserted while the pass runs
+        blockCapacity = blocks.empty() ? max<size_t>(numItems, 1) : max<size_t>(numItems / 8, 64);
+        RBTNode* nodes = static_cast<RBTNode*>(resource->allocate(blockCapacity * sizeof(RBTNode), alignof(RBTNode)));
+        blocks.push_back(NodeBlock{nodes, blockCapacity});
+        pooledSlots += blockCapacity;
+        blockUsed = 0;
+    }
+    RBTNode* fresh = new (&blocks.back().nodes[blockUsed++]) RBTNode(*node);
+    fresh->pooled = true;
+    pooledLive++;
+
+    if (node->parent == nullptr) root = fresh;
+    else if (node->parent->left == node) node->parent->left = fresh;
+    else node->parent->right = fresh;
+    if (node->left != nullptr) node->left->parent = fresh;
+    if (node->right != nullptr) node->right->parent = fresh;
+
+    FreeNode(node);
+    return fresh;
+}
+
+// O(n) shape and memory report. Walks the tree in order through the
+// parent pointers, so it needs no stack and allocates nothing.
+RBTShape RedBlackTree::Analyze() const {
+    RBTShape shape;
+    MergePending();
+    if (root == nullptr) return shape;
+
+    for (const RBTNode* n = root; n != nullptr; n = n->left) {
+        if (n->color == COLOR_BLACK) shape.blackHeight++;
+    }
+
+    const size_t pageSize = 4096;
+    unsigned long long depthSum = 0;
+    size_t redNodes = 0;
+    size_t pageJumps = 0;
+    double distanceSum = 0;
+    const RBTNode* prev = nullptr;
+
+    // Start at the leftmost node, tracking its depth on the way down
+    unsigned int depth = 0;
+    const RBTNode* curr = root;
+    while (curr->left != nullptr) {
+        curr = curr->left;
+        depth++;
+    }
+
+    while (curr != nullptr) {
+        shape.nodes++;
+        depthSum += depth;
+        if (depth > shape.maxDepth) shape.maxDepth = depth;
+        shape.depthHistogram[depth < RBT_DEPTH_BUCKETS ? depth : RBT_DEPTH_BUCKETS - 1]++;
+        if (curr->color == COLOR_RED) redNodes++;
+
+        if (prev != nullptr) {
+            uintptr_t a = reinterpret_cast<uintptr_t>(prev);
+            uintptr_t b = reinterpret_cast<uintptr_t>(curr);
+            distanceSum += (a > b) ? a - b : b - a;
+            if (a / pageSize != b / pageSize) pageJumps++;
+        }
+        prev = curr;
+
+        // Step to the in-order successor
+        if (curr->right != nullptr) {
+            curr = curr->right;
+            depth++;
+            while (curr->left != nullptr) {
+                curr = curr->left;
+                depth++;
+            }
+        } else {
+            while (curr->parent != nullptr && curr == curr->parent->right) {
+                curr = curr->parent;
+                depth--;
+            }
+            curr = curr->parent;
+            depth--;
+        }
+    }
+
+    shape.averageDepth = static_cast<double>(depthSum) / shape.nodes;
+    shape.redRatio = static_cast<double>(redNodes) / shape.nodes;
+    shape.nodeBytes = shape.nodes * sizeof(RBTNode);
+    if (shape.nodes > 1) {
+        shape.averageNeighborDistance = distanceSum / (shape.nodes - 1);
+        shape.pageJumpRatio = static_cast<double>(pageJumps) / (shape.nodes - 1);
+    }
+    return shape;
+}
+
+// O(n) invariant check. Walks the tree in order through the parent
+// pointers, tracking how many black nodes lie between here and the root.
+bool RedBlackTree::Validate(string *problem) const {
+    // Only builds a message once something is wrong
+    auto fail = [problem](const char* what, const RBTNode* node) {
+        if (problem) *problem = string(what) + (node ? " at " + to_string(node->data) : "");
+        return false;
+    };
+
+    // Every key the Bloom filter took in is either live or counted removed
+    if (!bloom.empty() && bloomKeys != numItems + bloomRemoved) {
+        return fail("Bloom filter key count does not match the tree", nullptr);
+    }
+
+    if (root == nullptr) return true;
+    if (root->parent != nullptr) return fail("root has a parent", root);
+    if (root->color != COLOR_BLACK) return fail("root is red", root);
+
+    size_t nodes = 0;
+    unsigned long long total = 0;
+    long long leafBlackHeight = -1;
+    const RBTNode* prev = nullptr;
+
+    // Start at the leftmost node, counting blacks on the way down
+    unsigned int blacks = 0;
+    const RBTNode* curr = root;
+    while (true) {
+        if (curr->color == COLOR_BLACK) blacks++;
+        if (curr->left == nullptr) break;
+        curr = curr->left;
+    }
+
+    while (curr != nullptr) {
+        nodes++;
+        total += curr->count;
+
+        if (prev != nullptr && prev->data >= curr->data) return fail("keys out of order", curr);
+        if ((curr->left && curr->left->parent != curr) || (curr->right && curr->right->parent != curr)) {
+            return fail("broken parent link", curr);
+        }
+        if (curr->color == COLOR_RED && !(IsBlack(curr->left) && IsBlack(curr->right))) {
+            return fail("red node with a red child", curr);
+        }
+        if (curr->count == 0 || (!multiset && curr->count != 1)) return fail("bad count", curr);
+        if (curr->hash != SubtreeHash(curr)) return fail("stale subtree hash", curr);
+        if (curr->left == nullptr || curr->right == nullptr) {
+            if (leafBlackHeight < 0) leafBlackHeight = blacks;
+            if (leafBlackHeight != blacks) return fail("unequal black-height", curr);
+        }
+        prev = curr;
+
+        // Step to the in-order successor, keeping the black count current
+        if (curr->right != nullptr) {
+            curr = curr->right;
+            if (curr->color == COLOR_BLACK) blacks++;
+            while (curr->left != nullptr) {
+                curr = curr->left;
+                if (curr->color == COLOR_BLACK) blacks++;
+            }
+        } else {
+            while (curr->parent != nullptr && curr == curr->parent->right) {
+                if (curr->color == COLOR_BLACK) blacks--;
+                curr = curr->parent;
+            }
+            if (curr->color == COLOR_BLACK) blacks--;
+            curr = curr->parent;
+        }
+    }
+
+    if (nodes + pending.size() != numItems || total + pending.size() != totalItems) {
+        return fail("size does not match the nodes", nullptr);
+    }
+    return true;
+}
+
+// Leftmost node of the subtree rooted at node
+const RBTNode* RedBlackTree::FirstNode(const RBTNode* node) {
+    if (node == nullptr) return nullptr;
+    while (node->left != nullptr) node = node->left;
+    return node;
+}
+
+// In-order successor of node, found through the parent pointers
+const RBTNode* RedBlackTree::NextNode(const RBTNode* node) {
+    if (node->right != nullptr) return FirstNode(node->right);
+    while (node->parent != nullptr && node == node->parent->right) node = node->parent;
+    return node->parent;
+}
+
+// Resolve a requested thread count (0 = one per core)
+unsigned int RedBlackTree::ThreadCount(unsigned int threads) {
+    if (threads == 0) threads = thread::hardware_concurrency();
+    return threads > 0 ? threads : 1;
+}
+
+// Cut the tree into ordered chunks: about four subtrees per thread, so
+// an unlucky split still leaves other work to steal
+vector<RedBlackTree::Chunk> RedBlackTree::SplitChunks(unsigned int threads) const {
+    MergePending();
+    unsigned int depth = 0;
+    while ((size_t(1) << depth) < size_t(threads) * 4) depth++;
+    vector<Chunk> chunks;
+    SplitChunks(root, depth, chunks);
+    return chunks;
+}
+
+void RedBlackTree::SplitChunks(const RBTNode* node, unsigned int depth, vector<Chunk> &chunks) {
+    if (node == nullptr) return;
+    if (depth == 0) {
+        chunks.push_back(Chunk{node, true});
+        return;
+    }
+    SplitChunks(node->left, depth - 1, chunks);
+    chunks.push_back(Chunk{node, false});
+    SplitChunks(node->right, depth - 1, chunks);
+}
+
 // Infix (in-order) traversal to string
 string RedBlackTree::ToInfixString(const RBTNode* n) {
     if (n == nullptr) return "";
@@ -214,36 +1458,46 @@ RBTNode* RedBlackTree::GetUncle(RBTNode* node) const {
 
 // Perform a left rotation around node x
 void RedBlackTree::LeftRotate(RBTNode* x) {
-    RBTNode* y = x->right;
-    x->right = y->left;
-    if (y->left != nullptr) y->left->parent = x;
-    y->parent = x->parent;
-    if (!x->parent) root = y;
-    else if (x == x->parent->left) x->parent->left = y;
-    else x->parent->right = y;
-    y->left = x;
-    x->parent = y;
+    RBTLeftRotate(Links{*this}, x);
 }
 
 // Perform a right rotation around node x
 void RedBlackTree::RightRotate(RBTNode* x) {
-    RBTNode* y = x->left;
-    x->left = y->right;
-    if (y->right != nullptr) y->right->parent = x;
-    y->parent = x->parent;
-    if (!x->parent) root = y;
-    else if (x == x->parent->right) x->parent->right = y;
-    else x->parent->left = y;
-    y->right = x;
-    x->parent = y;
+    RBTRightRotate(Links{*this}, x);
+}
+
+// Link nodes[lo..hi] (sorted) into a balanced subtree. Every level above
+// redDepth is full, so colouring the nodes at redDepth red and the rest
+// black gives every root-to-leaf path the same black count.
+RBTNode* RedBlackTree::BuildBalanced(pmr::vector<RBTNode*> &nodes, size_t lo, size_t hi,
+        unsigned int depth, unsigned int redDepth, RBTNode* parent) {
+    size_t mid = lo + (hi - lo) / 2;
+    RBTNode* node = nodes[mid];
+    node->parent = parent;
+    node->color = (depth == redDepth) ? COLOR_RED : COLOR_BLACK;
+    node->left = (mid > lo) ? BuildBalanced(nodes, lo, mid - 1, depth + 1, redDepth, node) : nullptr;
+    node->right = (mid < hi) ? BuildBalanced(nodes, mid + 1, hi, depth + 1, redDepth, node) : nullptr;
+    node->hash = SubtreeHash(node);
+    return node;
+}
+
+// Replace the tree's shape with a balanced tree over nodes (sorted) in O(n)
+void RedBlackTree::Rebuild(pmr::vector<RBTNode*> &nodes) {
+    if (nodes.empty()) {
+        root = nullptr;
+        return;
+    }
+    unsigned int redDepth = 0;
+    while ((size_t(2) << redDepth) <= nodes.size() + 1) redDepth++;
+    root = BuildBalanced(nodes, 0, nodes.size() - 1, 0, redDepth, nullptr);
 }
 
 // Deep copy a subtree rooted at node
 RBTNode* RedBlackTree::CopyOf(const RBTNode* node) {
     if (!node) return nullptr;
-    RBTNode* newNode = new RBTNode;
-    newNode->data = node->data;
-    newNode->color = node->color;
+    RBTNode* newNode = NewNode(node->data, node->color);
+    newNode->count = node->count;
+    newNode->hash = node->hash;
     newNode->IsNullNode = node->IsNullNode;
     newNode->left = CopyOf(node->left);
     newNode->right = CopyOf(node->right);
@@ -252,6 +1506,50 @@ RBTNode* RedBlackTree::CopyOf(const RBTNode* node) {
     return newNode;
 }
 
+// Allocate a detached node holding data
+RBTNode* RedBlackTree::NewNode(int data, unsigned short int color) {
+    RBT_STAT_INC(nodesAllocated);
+    RBTNode* node = new (resource->allocate(sizeof(RBTNode), alignof(RBTNode))) RBTNode;
+    node->data = data;
+    node->color = color;
+    node->hash = KeyHash(data);
+    return node;
+}
+
+// Free every node of a subtree
+void RedBlackTree::FreeTree(RBTNode* node) {
+    if (node == nullptr) return;
+    FreeTree(node->left);
+    FreeTree(node->right);
+    FreeNode(node);
+}
+
+// Free a node, unless it lives in a compaction block
+void RedBlackTree::FreeNode(RBTNode* node) {
+    if (node->pooled) {
+        pooledLive--;
+        return;
+    }
+    node->~RBTNode();
+    resource->deallocate(node, sizeof(RBTNode), alignof(RBTNode));
+}
+
+// Return a compaction block to the memory resource
+void RedBlackTree::FreeBlock(const NodeBlock &block) {
+    pooledSlots -= block.capacity;
+    resource->deallocate(block.nodes, block.capacity * sizeof(RBTNode), alignof(RBTNode));
+}
+
+// Free every compaction block (their nodes must already be unreachable)
+void RedBlackTree::FreeBlocks() {
+    for (const NodeBlock &block : blocks) FreeBlock(block);
+    for (const NodeBlock &block : retiredBlocks) FreeBlock(block);
+    blocks.clear();
+    retiredBlocks.clear();
+    blockUsed = blockCapacity = 0;
+    compacting = false;
+}
+
 // Tests for private helper methods
 void RedBlackTree::PrivateTests() {
     cout << "Running PrivateTests()..." << endl;
@@ -290,6 +1588,9 @@ void RedBlackTree::PrivateTests() {
     node2->left = node4;
     assert(GetUncle(node4) == node3);
 
+    // Test Validate: node4 is a red child of a red node
+    assert(!Validate());
+
     // Test LeftRotate and RightRotate
     LeftRotate(node1);
     assert(root == node3);
@@ -320,9 +1621,7 @@ void RedBlackTree::PrivateTests() {
     // Manual memory cleanup
     delete node4;
     delete newNode;
-    delete rootCopy->left;
-    delete rootCopy->right;
-    delete rootCopy;
+    FreeTree(rootCopy);
     delete node3;
     delete node2;
     delete node1;
@@ -6,7 +6,14 @@
 #define COLOR_BLACK 1
 #define COLOR_DOUBLE_BLACK 2
 
+// Number of depth buckets kept by the descent histograms in RBTStats
+#define RBT_DEPTH_BUCKETS 64
+
 #include <iostream>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <memory_resource>
 
 using namespace std;
 
@@ -18,10 +25,70 @@ struct RBTNode {
 	RBTNode *right = nullptr;
 	RBTNode *parent = nullptr;
 	bool IsNullNode = false;
+	bool pooled = false;
+	unsigned int count = 1;
+
+	// Sum of count * KeyHash(key) over this subtree. A sum does not depend
+	// on the tree's shape, so equal key sets always hash equal.
+	unsigned long long hash = 0;
+};
+
+
+// Snapshot of the operation counters, summed over every thread.
+// Only populated when compiled with -DRBT_STATS, otherwise all zero.
+struct RBTStats {
+	unsigned long long leftRotations = 0;
+	unsigned long long rightRotations = 0;
+
+	// InsertFixUp cases, named the same way as in the code
+	unsigned long long fixupRecolor = 0;
+	unsigned long long fixupLeftLeft = 0;
+	unsigned long long fixupRightRight = 0;
+	unsigned long long fixupLeftRight = 0;
+	unsigned long long fixupRightLeft = 0;
+
+	// containsDepth[d] = number of Contains() calls that stopped at depth d
+	unsigned long long containsDepth[RBT_DEPTH_BUCKETS] = {0};
+	unsigned long long insertDepth[RBT_DEPTH_BUCKETS] = {0};
+
+	unsigned long long nodesAllocated = 0;
+	unsigned long long treeCopies = 0;
+};
+
+
+// Shape and memory report produced by RedBlackTree::Analyze()
+struct RBTShape {
+	size_t nodes = 0;
+
+	// Black nodes on the path from the root to a null leaf
+	unsigned int blackHeight = 0;
+
+	// Depths count edges from the root (the root is depth 0)
+	unsigned int maxDepth = 0;
+	double averageDepth = 0;
+	unsigned long long depthHistogram[RBT_DEPTH_BUCKETS] = {0};
+
+	double redRatio = 0;
+	size_t nodeBytes = 0;
+
+	// How scattered the nodes are: mean address distance between in-order
+	// neighbours, and the fraction of neighbours on different 4 KiB pages
+	double averageNeighborDistance = 0;
+	double pageJumpRatio = 0;
+};
+
+
+// Hit/miss counters of a hot-key lookup cache
+struct RBTCacheStats {
+	unsigned long long hits = 0;
+	unsigned long long misses = 0;
 };
 
 
 class RedBlackTree {
+
+	friend class SharedRedBlackTree;
+	friend class RBTLookupCache;
 	
 	public:
 		void PrivateTests();
@@ -29,23 +96,231 @@ class RedBlackTree {
 		RedBlackTree(int newData);
 		RedBlackTree(const RedBlackTree &rbt);
 
-		string ToInfixString() const {return ToInfixString(root);};
-		string ToPrefixString() const { return ToPrefixString(root);};
-		string ToPostfixString() const { return ToPostfixString(root);};
+		// Every node, compaction block, buffer and table comes from
+		// resource, which must outlive the tree. Copies share the source
+		// tree's resource and freeNodes unless a resource is given. With
+		// freeNodes false the destructor leaves its nodes to the resource,
+		// for arenas (a monotonic_buffer_resource, say) that reclaim
+		// everything at once when released.
+		explicit RedBlackTree(pmr::memory_resource *resource, bool freeNodes = true);
+		RedBlackTree(const RedBlackTree &rbt, pmr::memory_resource *resource, bool freeNodes = true);
+		pmr::memory_resource *Resource() const {return resource;};
+
+		virtual ~RedBlackTree();
+		RedBlackTree &operator=(const RedBlackTree &rbt);
+
+		// Same keys (and counts), whatever the shape. Trees with different
+		// hashes are told apart in O(1); otherwise the keys are compared
+		// with a streaming in-order merge that allocates nothing.
+		bool operator==(const RedBlackTree &rbt) const;
+		bool operator!=(const RedBlackTree &rbt) const {return !(*this == rbt);};
+
+		// Order-independent hash of every key (and count), kept up to date
+		// in the nodes, so Hash() is O(1) plus the insert buffer
+		unsigned long long Hash() const;
+
+		// Keys whose count is higher in a (onlyInA) or in b (onlyInB). Key
+		// ranges whose hashes match are skipped, so the cost follows the
+		// number of differences rather than the tree sizes. Insert
+		// buffers are merged first.
+		static void Diff(const RedBlackTree &a, const RedBlackTree &b, vector<int> &onlyInA, vector<int> &onlyInB);
+
+		string ToInfixString() const {MergePending(); return ToInfixString(root);};
+		string ToPrefixString() const {MergePending(); return ToPrefixString(root);};
+		string ToPostfixString() const {MergePending(); return ToPostfixString(root);};
 
 		void Insert(int newData);
+		void Remove(int data);
 		
 		bool Contains(int data) const ;
 		size_t Size() const {return numItems;};
+
+		// Multiset mode: duplicate inserts bump the key's count in place
+		// and Remove() takes one occurrence away. The insert buffer is
+		// bypassed while this is on. Size() counts distinct keys and
+		// TotalSize() counts every occurrence.
+		void SetMultiset(bool enabled);
+		unsigned int Count(int data) const;
+		size_t TotalSize() const {return totalItems;};
+
 		int GetMin() const;
 		int GetMax() const;
 
+		// Nearest keys: Floor (largest <= x), Ceiling (smallest >= x),
+		// Predecessor (largest < x) and Successor (smallest > x). Each
+		// returns false when there is no such key, and never allocates.
+		bool Floor(int x, int &out) const;
+		bool Ceiling(int x, int &out) const;
+		bool Predecessor(int x, int &out) const;
+		bool Successor(int x, int &out) const;
+
+		// Copy up to k keys greater than x, in order, into out and return
+		// how many were written. O(log n + k) once the insert buffer,
+		// which it merges first, is in the tree.
+		size_t NextK(int x, size_t k, int *out) const;
+
+		// Top-N mode: with a capacity set, an insert into a full tree
+		// evicts the minimum (or maximum) key in the same operation and
+		// reuses its node, so a steady stream allocates nothing. Keys that
+		// would be evicted at once are dropped in O(1) by comparing with
+		// the cached boundary key. Not available for multisets; the insert
+		// buffer is bypassed. 0 removes the bound.
+		void SetCapacity(size_t capacity, bool evictMin = true);
+		size_t Capacity() const {return capacity;};
+
+		// Write-optimized mode: up to capacity inserts are parked in an
+		// unsorted buffer and merged into the tree in bulk when it fills.
+		// Contains/GetMin/GetMax/Size and the nearest-key queries scan the
+		// buffer. The first read that needs the tree's order or shape (the
+		// ToXString() methods, ForEach, Analyze, the parallel walks)
+		// merges it instead, so such a read must not race other readers.
+		void SetInsertBuffer(size_t capacity);
+		void FlushInsertBuffer();
+		size_t Buffered() const {return pending.size();};
+
+		// Hot-key cache: Contains() first probes a direct-mapped table of
+		// recent answers, found or not, with slots rounded up to a power
+		// of two (0 turns it off). Insert and Remove clear only their own
+		// key's slot. Contains() writes the table, so threads reading
+		// concurrently should each use an RBTLookupCache instead.
+		void SetLookupCache(size_t slots);
+		RBTCacheStats LookupCacheStats() const {return cacheStats;};
+
+		// Negative lookups: a Bloom filter of 512-bit blocks, one cache
+		// line each, lets Contains() reject most absent keys with a single
+		// probe. It is sized for targetFpr within maxBytes and rebuilt
+		// when growth pushes its estimated rate past twice the target, or
+		// once half its keys have been removed. MayContain() is the raw
+		// filter answer (always true when it is off).
+		void EnableBloomFilter(double targetFpr = 0.01, size_t maxBytes = 64 * 1024 * 1024);
+		void DisableBloomFilter();
+		bool MayContain(int data) const;
+		double BloomFalsePositiveRate() const;
+		size_t BloomBytes() const {return bloom.size() * sizeof(BloomBlock);};
+
+		// Bumped by every change to the key set
+		unsigned long long Version() const {return version;};
+
+		// Replace the contents with keys (strictly increasing) in O(n).
+		// The nodes share one allocation, laid out in key order, which
+		// Remove() cannot give back a node at a time: a removed key's
+		// slot stays allocated until a compaction pass. Once most of
+		// the pooled bytes (and at least 1 MiB) are dead, Remove() runs
+		// that pass itself, a few nodes per call.
+		void LoadSorted(const vector<int> &keys);
+
+		// Call fn(key) for each distinct key in order, without allocating
+		// once the insert buffer has been merged.
+		template <class Fn>
+		void ForEach(Fn fn) const {
+			MergePending();
+			for (const RBTNode *n = FirstNode(root); n != nullptr; n = NextNode(n)) {
+				fn(n->data);
+			}
+		};
+
+		// Incremental compaction: relocate nodes, in key order, into fresh
+		// contiguous blocks. Each step moves at most maxNodes nodes so it
+		// can be interleaved with other operations; it returns true once
+		// a full pass has finished. Compact() runs a whole pass.
+		bool CompactStep(size_t maxNodes);
+		void Compact();
+
+		// Split the tree into ordered chunks (whole subtrees near the top,
+		// plus the single nodes above them) and spread them over threads
+		// (0 = one per core). ParallelForEach calls fn(key) concurrently in
+		// no particular order. ParallelReduce maps each key, folds every
+		// chunk in key order, then folds the chunk results left to right
+		// after init, so combine only has to be associative.
+		template <class Fn>
+		void ParallelForEach(Fn fn, unsigned int threads = 0) const;
+		template <class T, class Map, class Combine>
+		T ParallelReduce(T init, Map map, Combine combine, unsigned int threads = 0) const;
+
+		RBTShape Analyze() const;
+
+		// O(n) check of the red-black invariants (black root, no red node
+		// with a red child, equal black-height on every path), BST order,
+		// parent links and subtree hashes. Iterative, allocation-free.
+		// On failure it returns false and describes the first problem.
+		bool Validate(string *problem = nullptr) const;
+
+		static RBTStats Stats();
+		static void ResetStats();
 		
 		
 	
-	private: 
+	protected:
 		unsigned long long int numItems  = 0;
+		unsigned long long int totalItems = 0;
 		RBTNode *root = nullptr;
+
+		void InsertNode(RBTNode *node);
+		void BasicInsert(RBTNode *node);
+		void InsertFixUp(RBTNode *node);
+
+		void LeftRotate(RBTNode *node);
+		void RightRotate(RBTNode *node);
+
+		void RemoveNode(RBTNode *node);
+
+		// Called on each node whose children change during a rotation
+		// (lower node first), so subclasses can keep per-subtree fields
+		virtual void UpdateAugment(RBTNode *) {}
+
+		static unsigned long long KeyHash(int data);
+		static unsigned long long SubtreeHash(const RBTNode *node);
+
+	private: 
+		pmr::memory_resource *resource = pmr::get_default_resource();
+		bool freeNodes = true;
+
+		pmr::vector<int> pending{resource};
+		size_t pendingCapacity = 0;
+
+		bool multiset = false;
+
+		// Top-N bound and the key the next eviction would take
+		size_t capacity = 0;
+		bool evictMin = true;
+		int boundary = 0;
+
+		// Hot-key cache slots; state is 0 (empty), 1 (absent) or 2 (present)
+		struct CacheSlot {
+			int data;
+			unsigned char state;
+		};
+		mutable pmr::vector<CacheSlot> cache{resource};
+		mutable RBTCacheStats cacheStats;
+		unsigned long long version = 0;
+
+		// Bloom filter blocks, bits set per key, and the keys added and
+		// removed since it was last built
+		struct alignas(64) BloomBlock {
+			unsigned long long words[8];
+		};
+		pmr::vector<BloomBlock> bloom{resource};
+		unsigned int bloomHashes = 0;
+		double bloomTargetFpr = 0;
+		size_t bloomMaxBytes = 0;
+		size_t bloomKeys = 0;
+		size_t bloomRemoved = 0;
+		size_t bloomRebuildAt = 0;
+
+		// Compaction blocks: the current pass's blocks, and the previous
+		// pass's, which are freed once every live node has moved out
+		struct NodeBlock {
+			RBTNode *nodes;
+			size_t capacity;
+		};
+		pmr::vector<NodeBlock> blocks{resource};
+		pmr::vector<NodeBlock> retiredBlocks{resource};
+		size_t blockUsed = 0;
+		size_t blockCapacity = 0;
+		size_t pooledSlots = 0;
+		size_t pooledLive = 0;
+		bool compacting = false;
+		int compactCursor = 0;
 		
 		static string ToInfixString(const RBTNode *n);
 		static string ToPrefixString(const RBTNode *n);
@@ -54,22 +329,164 @@ class RedBlackTree {
 		static string GetColorString(const RBTNode *n);
 		static string GetNodeString(const RBTNode *n);
 		
-		void BasicInsert(RBTNode *node);
-		void InsertFixUp(RBTNode *node);
-		
+		void MergePending() const;
+		bool Lookup(int data) const;
+		static CacheSlot &Probe(pmr::vector<CacheSlot> &slots, int data);
+		void KeyChanged(int data);
+		void KeysReplaced();
+
+		void BloomSet(int data);
+		void BloomAdd(int data);
+		void BloomRemoved();
+		void BuildBloomFilter();
+		void CopyBloomFilter(const RedBlackTree &rbt);
+
+		void InsertCounted(int newData);
+		void InsertEvicting(int newData);
+		void Trim();
+		RBTNode *BoundaryNode() const;
+		void Transplant(RBTNode *oldNode, RBTNode *newNode);
+		void RemoveFixUp(RBTNode *node, RBTNode *parent);
+		static bool IsBlack(const RBTNode *node);
+
+		const RBTNode *FloorNode(int x, bool inclusive) const;
+		const RBTNode *CeilingNode(int x, bool inclusive) const;
+
+		static const RBTNode *FirstNode(const RBTNode *node);
+		static const RBTNode *NextNode(const RBTNode *node);
+
+		// A unit of parallel work: a whole subtree, or just one node
+		struct Chunk {
+			const RBTNode *node;
+			bool subtree;
+		};
+		vector<Chunk> SplitChunks(unsigned int threads) const;
+		static void SplitChunks(const RBTNode *node, unsigned int depth, vector<Chunk> &chunks);
+		static unsigned int ThreadCount(unsigned int threads);
+		template <class Fn>
+		static void VisitChunk(const Chunk &chunk, Fn fn);
+		template <class Task>
+		static void RunParallel(size_t tasks, unsigned int threads, Task task);
+
+		unsigned long long HashBelow(long long bound) const;
+		static void Diff(const RedBlackTree &a, const RedBlackTree &b, long long low, long long high,
+			vector<int> &onlyInA, vector<int> &onlyInB);
+
+		// Policy for the fix-up and rotations in RedBlackTreeBalance.h
+		struct Links;
+
 		RBTNode *GetUncle(RBTNode *node) const;
 		
 		bool IsLeftChild(RBTNode *node) const;
 		bool IsRightChild(RBTNode *node) const;
 		
-		void LeftRotate(RBTNode *node);
-		void RightRotate(RBTNode *node);
-		
+		static RBTNode *BuildBalanced(pmr::vector<RBTNode*> &nodes, size_t lo, size_t hi,
+			unsigned int depth, unsigned int redDepth, RBTNode *parent);
+		void Rebuild(pmr::vector<RBTNode*> &nodes);
+
 		RBTNode *CopyOf(const RBTNode *node);
+		RBTNode *NewNode(int data, unsigned short int color);
+		void FreeNode(RBTNode *node);
+		void FreeTree(RBTNode *node);
+		void FreeBlock(const NodeBlock &block);
+		void FreeBlocks();
+		void ReclaimPooled();
+		RBTNode *Relocate(RBTNode *node);
 
 
 		RBTNode *Get(int data) const;
 
 };
 
+
+// Hot-key cache for one reader thread. Many threads can share a tree
+// under a read lock, each probing its own RBTLookupCache; the cache
+// drops all its slots whenever the tree's Version() has moved on.
+class RBTLookupCache {
+
+	public:
+		explicit RBTLookupCache(const RedBlackTree &tree, size_t slots = 1024);
+
+		bool Contains(int data);
+		RBTCacheStats Stats() const {return stats;};
+
+	private:
+		const RedBlackTree &tree;
+		pmr::vector<RedBlackTree::CacheSlot> slots;
+		unsigned long long version;
+		RBTCacheStats stats;
+
+};
+
+
+// Call fn(key) for every key of one chunk, in order
+template <class Fn>
+void RedBlackTree::VisitChunk(const Chunk &chunk, Fn fn) {
+	if (!chunk.subtree) {
+		fn(chunk.node->data);
+		return;
+	}
+	// The walk leaves the subtree at the successor of its rightmost node
+	const RBTNode *stop = chunk.node;
+	while (stop->right != nullptr) stop = stop->right;
+	stop = NextNode(stop);
+	for (const RBTNode *n = FirstNode(chunk.node); n != stop; n = NextNode(n)) {
+		fn(n->data);
+	}
+}
+
+// Run task(i) for i in [0, tasks) on up to threads threads
+template <class Task>
+void RedBlackTree::RunParallel(size_t tasks, unsigned int threads, Task task) {
+	atomic<size_t> next(0);
+	auto worker = [&]() {
+		for (size_t i = next++; i < tasks; i = next++) task(i);
+	};
+	vector<thread> pool;
+	for (unsigned int t = 1; t < threads && t < tasks; t++) pool.push_back(thread(worker));
+	worker();
+	for (thread &t : pool) t.join();
+}
+
+template <class Fn>
+void RedBlackTree::ParallelForEach(Fn fn, unsigned int threads) const {
+	threads = ThreadCount(threads);
+	vector<Chunk> chunks = SplitChunks(threads);
+	RunParallel(chunks.size(), threads, [&](size_t i) {
+		VisitChunk(chunks[i], fn);
+	});
+}
+
+template <class T, class Map, class Combine>
+T RedBlackTree::ParallelReduce(T init, Map map, Combine combine, unsigned int threads) const {
+	threads = ThreadCount(threads);
+	vector<Chunk> chunks = SplitChunks(threads);
+
+	// One cache line (or more) per chunk: no false sharing, and no packed
+	// vector<bool> words written from two threads
+	struct alignas(64) Partial {
+		T value;
+		bool set;
+	};
+	vector<Partial> partials(chunks.size(), Partial{init, false});
+
+	RunParallel(chunks.size(), threads, [&](size_t i) {
+		Partial &partial = partials[i];
+		VisitChunk(chunks[i], [&](int data) {
+			if (partial.set) {
+				partial.value = combine(partial.value, map(data));
+			} else {
+				partial.value = map(data);
+				partial.set = true;
+			}
+		});
+	});
+
+	T result = init;
+	for (const Partial &partial : partials) {
+		if (partial.set) result = combine(result, partial.value);
+	}
+	return result;
+}
+
 #endif
@@ -0,0 +1,133 @@
+#ifndef REDBLACKTREEBALANCE_H
+#define REDBLACKTREEBALANCE_H
+
+#include "RedBlackTree.h"
+#include <stdexcept>
+
+using namespace std;
+
+
+// Insert fix-up and rotations shared by RedBlackTree and the constexpr
+// StaticRedBlackTree. They work on any node representation through a
+// Links policy, so pointer nodes and index nodes run the same cases:
+//
+//   Links::NONE               the null link (nullptr, or -1 for indices)
+//   Left(n), Right(n),
+//   Parent(n), Root()         references to the links, assignable
+//   Color(n)                  reference to the node's colour
+//   Rotated(x, y)             after a rotation lifts y above x
+//   Step(step)                each rotation and fix-up case, for stats
+//
+// Everything is constexpr so StaticRedBlackTree can build at compile time.
+
+// Rotations and InsertFixUp cases reported to Links::Step()
+enum class RBTStep {LeftRotate, RightRotate, Recolor, LeftLeft, RightRight, LeftRight, RightLeft};
+
+// Check if a node is a left child of its parent
+template <class Links, class Node>
+constexpr bool RBTIsLeftChild(const Links &links, Node node) {
+	return links.Parent(node) != Links::NONE && links.Left(links.Parent(node)) == node;
+}
+
+// Check if a node is a right child of its parent
+template <class Links, class Node>
+constexpr bool RBTIsRightChild(const Links &links, Node node) {
+	return links.Parent(node) != Links::NONE && links.Right(links.Parent(node)) == node;
+}
+
+// Get the uncle node of a given node
+template <class Links, class Node>
+constexpr Node RBTGetUncle(const Links &links, Node node) {
+	Node parent = links.Parent(node);
+	Node grandParent = parent != Links::NONE ? links.Parent(parent) : Links::NONE;
+	if (grandParent == Links::NONE) return Links::NONE;
+	return (links.Left(grandParent) == parent) ? links.Right(grandParent) : links.Left(grandParent);
+}
+
+// Perform a left rotation around node x
+template <class Links, class Node>
+constexpr void RBTLeftRotate(const Links &links, Node x) {
+	links.Step(RBTStep::LeftRotate);
+	Node y = links.Right(x);
+	links.Right(x) = links.Left(y);
+	if (links.Left(y) != Links::NONE) links.Parent(links.Left(y)) = x;
+	links.Parent(y) = links.Parent(x);
+	if (links.Parent(x) == Links::NONE) links.Root() = y;
+	else if (x == links.Left(links.Parent(x))) links.Left(links.Parent(x)) = y;
+	else links.Right(links.Parent(x)) = y;
+	links.Left(y) = x;
+	links.Parent(x) = y;
+	links.Rotated(x, y);
+}
+
+// Perform a right rotation around node x
+template <class Links, class Node>
+constexpr void RBTRightRotate(const Links &links, Node x) {
+	links.Step(RBTStep::RightRotate);
+	Node y = links.Left(x);
+	links.Left(x) = links.Right(y);
+	if (links.Right(y) != Links::NONE) links.Parent(links.Right(y)) = x;
+	links.Parent(y) = links.Parent(x);
+	if (links.Parent(x) == Links::NONE) links.Root() = y;
+	else if (x == links.Right(links.Parent(x))) links.Right(links.Parent(x)) = y;
+	else links.Left(links.Parent(x)) = y;
+	links.Right(y) = x;
+	links.Parent(x) = y;
+	links.Rotated(x, y);
+}
+
+// Fix violations of Red-Black Tree properties after inserting a red node
+// under a red parent
+template <class Links, class Node>
+constexpr void RBTInsertFixUp(const Links &links, Node node) {
+	Node parent = links.Parent(node);
+	Node uncle = RBTGetUncle(links, node);
+	Node grandParent = links.Parent(parent);
+
+	if (uncle != Links::NONE && links.Color(uncle) == COLOR_RED) {
+		// Case 1: Uncle is red -> recolor
+		links.Step(RBTStep::Recolor);
+		links.Color(parent) = COLOR_BLACK;
+		links.Color(uncle) = COLOR_BLACK;
+		if (grandParent != Links::NONE) {
+			links.Color(grandParent) = COLOR_RED;
+			Node greatGrandParent = links.Parent(grandParent);
+			if (greatGrandParent != Links::NONE && links.Color(greatGrandParent) == COLOR_RED) {
+				RBTInsertFixUp(links, grandParent);
+			}
+		}
+	} else if (grandParent != Links::NONE) {
+		// Uncle is black or null -> rotations needed
+		links.Color(grandParent) = COLOR_RED;
+
+		if (RBTIsLeftChild(links, node) && RBTIsLeftChild(links, parent)) {
+			// Left-Left Case
+			links.Step(RBTStep::LeftLeft);
+			RBTRightRotate(links, grandParent);
+			links.Color(parent) = COLOR_BLACK;
+		} else if (RBTIsRightChild(links, node) && RBTIsRightChild(links, parent)) {
+			// Right-Right Case
+			links.Step(RBTStep::RightRight);
+			RBTLeftRotate(links, grandParent);
+			links.Color(parent) = COLOR_BLACK;
+		} else if (RBTIsLeftChild(links, node) && RBTIsRightChild(links, parent)) {
+			// Left-Right Case
+			links.Step(RBTStep::LeftRight);
+			RBTRightRotate(links, parent);
+			RBTLeftRotate(links, grandParent);
+			links.Color(node) = COLOR_BLACK;
+			links.Color(parent) = COLOR_RED;
+		} else if (RBTIsRightChild(links, node) && RBTIsLeftChild(links, parent)) {
+			// Right-Left Case
+			links.Step(RBTStep::RightLeft);
+			RBTLeftRotate(links, parent);
+			RBTRightRotate(links, grandParent);
+			links.Color(node) = COLOR_BLACK;
+			links.Color(parent) = COLOR_RED;
+		} else {
+			throw invalid_argument("impossible state!");
+		}
+	}
+}
+
+#endif
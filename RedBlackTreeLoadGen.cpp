@@ -0,0 +1,126 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <random>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+#include "KeySetServer.h"
+
+/**
+ *
+ * Load generator for rbt-server: each client connection sends batches of
+ * pipelined requests and waits for each batch's replies. Reports
+ * requests per second and per-request latency, taken as the round trip
+ * of the batch a request travelled in.
+ *
+ * Usage: rbt-loadgen SOCKET [--clients N] [--requests N] [--pipeline N]
+ *                    [--keys N] [--reads PERCENT] [--seed N]
+ *
+**/
+
+using namespace std;
+using namespace std::chrono;
+
+struct LoadConfig {
+	string socketPath;
+	unsigned int clients = 4;
+	size_t requests = 1000000;
+	size_t pipeline = 64;
+	int keys = 1 << 20;
+	int readPercent = 90;
+	unsigned int seed = 1;
+};
+
+// One client's share of the requests; latencies in nanoseconds
+void RunClient(const LoadConfig &config, unsigned int id, vector<unsigned int> &latencies) {
+	KeySetClient client(config.socketPath);
+	mt19937 rng(config.seed * 7919 + id);
+	size_t total = config.requests / config.clients;
+	latencies.reserve(total);
+
+	for (size_t done = 0; done < total; ) {
+		size_t batch = min(config.pipeline, total - done);
+		for (size_t i = 0; i < batch; i++) {
+			int key = rng() % config.keys;
+			int roll = rng() % 100;
+			if (roll < config.readPercent) {
+				if (roll == 0) client.Queue(KeySetOp::Range, key, 16);
+				else client.Queue(KeySetOp::Contains, key);
+			} else {
+				client.Queue(roll % 2 ? KeySetOp::Insert : KeySetOp::Remove, key);
+			}
+		}
+
+		steady_clock::time_point start = steady_clock::now();
+		client.Flush();
+		unsigned int elapsed = static_cast<unsigned int>(min<long long>(duration_cast<nanoseconds>(steady_clock::now() - start).count(), 0xFFFFFFFFLL));
+		latencies.insert(latencies.end(), batch, elapsed);
+		done += batch;
+	}
+}
+
+int main(int argc, char **argv) {
+	LoadConfig config;
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "--clients" && hasValue) config.clients = max(1ul, stoul(argv[++i]));
+		else if (arg == "--requests" && hasValue) config.requests = stoull(argv[++i]);
+		else if (arg == "--pipeline" && hasValue) config.pipeline = max(1ull, stoull(argv[++i]));
+		else if (arg == "--keys" && hasValue) config.keys = stoi(argv[++i]);
+		else if (arg == "--reads" && hasValue) config.readPercent = stoi(argv[++i]);
+		else if (arg == "--seed" && hasValue) config.seed = stoul(argv[++i]);
+		else if (config.socketPath.empty() && arg.rfind("--", 0) != 0) config.socketPath = arg;
+		else {
+			cerr << "Unknown option " << arg << endl;
+			return 2;
+		}
+	}
+	if (config.socketPath.empty()) {
+		cerr << "Usage: rbt-loadgen SOCKET [--clients N] [--requests N] [--pipeline N] [--keys N] [--reads PERCENT]" << endl;
+		return 2;
+	}
+
+	vector<vector<unsigned int> > latencies(config.clients);
+	vector<string> errors(config.clients);
+	steady_clock::time_point start = steady_clock::now();
+	vector<thread> clients;
+	for (unsigned int c = 0; c < config.clients; c++) {
+		clients.push_back(thread([&config, &latencies, &errors, c]() {
+			try {
+				RunClient(config, c, latencies[c]);
+			} catch (exception &e) {
+				errors[c] = e.what();
+			}
+		}));
+	}
+	for (thread &client : clients) {
+		client.join();
+	}
+	double seconds = duration<double>(steady_clock::now() - start).count();
+
+	for (const string &error : errors) {
+		if (!error.empty()) {
+			cerr << error << endl;
+			return 1;
+		}
+	}
+
+	vector<unsigned int> all;
+	for (vector<unsigned int> &samples : latencies) {
+		all.insert(all.end(), samples.begin(), samples.end());
+	}
+	sort(all.begin(), all.end());
+	auto percentile = [&all](double q) {
+		return all.empty() ? 0.0 : all[static_cast<size_t>(q * (all.size() - 1))] / 1000.0;
+	};
+
+	cout << config.clients << " clients, pipeline " << config.pipeline << ", " << config.readPercent << "% reads" << endl;
+	cout << fixed << setprecision(0) << all.size() / seconds << " requests/s" << endl;
+	cout << setprecision(1) << "latency us: p50 " << percentile(0.50) << ", p99 " << percentile(0.99)
+		<< ", p99.9 " << percentile(0.999) << endl;
+	return 0;
+}
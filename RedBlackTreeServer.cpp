@@ -0,0 +1,67 @@
+#include <iostream>
+#include <string>
+#include <csignal>
+#include <stdexcept>
+#include "RedBlackTree.h"
+#include "BulkLoader.h"
+#include "KeySetServer.h"
+
+/**
+ *
+ * Key set server: owns one RedBlackTree and serves it to local processes
+ * over a Unix domain socket (see KeySetServer.h for the protocol).
+ *
+ * Usage: rbt-server SOCKET [--load FILE [--binary]]
+ *
+ * SIGINT or SIGTERM shuts it down cleanly.
+ *
+**/
+
+using namespace std;
+
+KeySetServer *running = nullptr;
+
+void OnSignal(int) {
+	if (running != nullptr) running->Stop();
+}
+
+int main(int argc, char **argv) {
+	string socketPath;
+	string loadPath;
+	bool binary = false;
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		if (arg == "--load" && i + 1 < argc) loadPath = argv[++i];
+		else if (arg == "--binary") binary = true;
+		else if (socketPath.empty() && arg.rfind("--", 0) != 0) socketPath = arg;
+		else {
+			cerr << "Unknown option " << arg << endl;
+			return 2;
+		}
+	}
+	if (socketPath.empty()) {
+		cerr << "Usage: rbt-server SOCKET [--load FILE [--binary]]" << endl;
+		return 2;
+	}
+
+	try {
+		RedBlackTree tree = RedBlackTree();
+		if (!loadPath.empty()) {
+			RBTLoadReport report = LoadKeyFile(loadPath, tree, binary ? KeyFormat::Binary : KeyFormat::Text);
+			cout << "Loaded " << report.keysLoaded << " keys in " << report.TotalSeconds() << " s" << endl;
+		}
+
+		KeySetServer server(socketPath, tree);
+		running = &server;
+		signal(SIGINT, OnSignal);
+		signal(SIGTERM, OnSignal);
+		cout << "Serving " << tree.Size() << " keys on " << socketPath << endl;
+		server.Run();
+		running = nullptr;
+		cout << "Served " << server.Requests() << " requests" << endl;
+	} catch (exception &e) {
+		cerr << e.what() << endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,315 @@
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <shared_mutex>
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+#include <stdexcept>
+#include "RedBlackTree.h"
+#include "HugePageResource.h"
+#include "TopDownRedBlackTree.h"
+
+/**
+ *
+ * Stress test: randomized mixed workloads against one shared tree from
+ * several threads, checking the red-black invariants as it goes.
+ *
+ * Usage: rbt-stress [--ops N] [--threads 1,2,4,8] [--reads 50,90,99]
+ *                   [--keys N] [--validate-every N] [--seed N]
+ *                   [--arena default|huge|bind:NODE|interleave]
+ *                   [--mode mixed|topdown]
+ *
+ * Reads (Contains/GetMin/GetMax) share a reader/writer lock; writes
+ * (Insert/Remove) take it exclusively; copies read the whole tree under
+ * the shared lock. Latency includes time spent waiting for the lock.
+ * Any --arena but default puts the nodes in a HugePageResource; compare
+ * e.g. "--threads 1 --reads 100 --keys 50000000" with and without it.
+ *
+ * --mode topdown instead races insert/contains mixes on a RedBlackTree
+ * behind one mutex against a TopDownRedBlackTree using lock coupling.
+ *
+**/
+
+using namespace std;
+using namespace std::chrono;
+
+struct StressConfig {
+	size_t ops = 1000000;
+	vector<unsigned int> threads = {1, 2, 4, 8};
+	vector<int> readPercents = {50, 90, 99};
+	int keys = 1 << 16;
+	size_t validateEvery = 100000;
+	unsigned int seed = 1;
+	string arena = "default";
+	string mode = "mixed";
+};
+
+struct MixResult {
+	double opsPerSecond = 0;
+	double p50 = 0;
+	double p99 = 0;
+	double p999 = 0;
+	size_t validations = 0;
+};
+
+// Parse "1,2,4" into numbers
+template <class T>
+vector<T> ParseList(const string &text) {
+	vector<T> values;
+	stringstream in(text);
+	string item;
+	while (getline(in, item, ',')) {
+		values.push_back(static_cast<T>(stoll(item)));
+	}
+	return values;
+}
+
+// Check the tree, bailing out of the whole run on the first violation
+void ValidateOrDie(const RedBlackTree &tree) {
+	string problem;
+	if (!tree.Validate(&problem)) {
+		cerr << "INVARIANT VIOLATED: " << problem << endl;
+		exit(1);
+	}
+}
+
+// Latency (microseconds) at quantile q of the sorted samples
+double Percentile(const vector<unsigned int> &sorted, double q) {
+	if (sorted.empty()) return 0;
+	size_t i = static_cast<size_t>(q * (sorted.size() - 1));
+	return sorted[i] / 1000.0;
+}
+
+// The arena named by --arena, or nullptr for the default resource
+unique_ptr<HugePageResource> MakeArena(const string &arena) {
+	if (arena == "huge") return make_unique<HugePageResource>();
+	if (arena == "interleave") return make_unique<HugePageResource>(32 * HugePageResource::HugePageSize, NumaPolicy::Interleave);
+	if (arena.rfind("bind:", 0) == 0) {
+		return make_unique<HugePageResource>(32 * HugePageResource::HugePageSize, NumaPolicy::Bind, stoi(arena.substr(5)));
+	}
+	if (arena != "default") throw invalid_argument("Unknown arena " + arena);
+	return nullptr;
+}
+
+MixResult RunMix(const StressConfig &config, unsigned int threads, int readPercent) {
+	unique_ptr<HugePageResource> arena = MakeArena(config.arena);
+	RedBlackTree tree = RedBlackTree(arena ? arena.get() : pmr::get_default_resource());
+	shared_mutex lock;
+
+	// Start half full so inserts and removes both succeed often
+	mt19937 fill(config.seed);
+	for (int i = 0; i < config.keys / 2; i++) {
+		int key = fill() % config.keys;
+		if (!tree.Contains(key)) tree.Insert(key);
+	}
+	ValidateOrDie(tree);
+
+	atomic<size_t> done(0);
+	atomic<size_t> validations(0);
+	vector<vector<unsigned int> > latencies(threads);
+	size_t perThread = config.ops / threads;
+
+	auto worker = [&](unsigned int id) {
+		mt19937 rng(config.seed * 7919 + id);
+		vector<unsigned int> &samples = latencies[id];
+		samples.reserve(perThread);
+
+		for (size_t i = 0; i < perThread; i++) {
+			int key = rng() % config.keys;
+			int roll = rng() % 1000;
+			steady_clock::time_point start = steady_clock::now();
+
+			if (roll < readPercent * 10) {
+				shared_lock<shared_mutex> guard(lock);
+				if (roll % 10 == 0 && tree.Size() > 0) {
+					volatile int low = tree.GetMin();
+					(void)low;
+				} else if (roll % 10 == 1 && tree.Size() > 0) {
+					volatile int high = tree.GetMax();
+					(void)high;
+				} else {
+					volatile bool found = tree.Contains(key);
+					(void)found;
+				}
+			} else if (roll == 999) {
+				shared_lock<shared_mutex> guard(lock);
+				RedBlackTree copy = RedBlackTree(tree);
+			} else {
+				unique_lock<shared_mutex> guard(lock);
+				if (roll % 2 == 0) {
+					if (!tree.Contains(key)) tree.Insert(key);
+				} else {
+					if (tree.Contains(key)) tree.Remove(key);
+				}
+			}
+
+			nanoseconds elapsed = steady_clock::now() - start;
+			samples.push_back(static_cast<unsigned int>(min<long long>(elapsed.count(), 0xFFFFFFFFLL)));
+
+			// Whoever crosses a checkpoint validates the shared tree
+			if (config.validateEvery > 0 && ++done % config.validateEvery == 0) {
+				shared_lock<shared_mutex> guard(lock);
+				ValidateOrDie(tree);
+				validations++;
+			}
+		}
+	};
+
+	steady_clock::time_point start = steady_clock::now();
+	vector<thread> pool;
+	for (unsigned int t = 0; t < threads; t++) {
+		pool.push_back(thread(worker, t));
+	}
+	for (thread &t : pool) {
+		t.join();
+	}
+	double seconds = duration<double>(steady_clock::now() - start).count();
+
+	ValidateOrDie(tree);
+
+	vector<unsigned int> all;
+	for (vector<unsigned int> &samples : latencies) {
+		all.insert(all.end(), samples.begin(), samples.end());
+	}
+	sort(all.begin(), all.end());
+
+	MixResult result;
+	result.opsPerSecond = all.size() / seconds;
+	result.p50 = Percentile(all, 0.50);
+	result.p99 = Percentile(all, 0.99);
+	result.p999 = Percentile(all, 0.999);
+	result.validations = validations + 2;
+	return result;
+}
+
+// ops/sec of an insert/contains mix run by threads against tree through
+// insert(key) and contains(key)
+template <class Insert, class Contains>
+double RunInsertMix(const StressConfig &config, unsigned int threads, int readPercent, Insert insert, Contains contains) {
+	size_t perThread = config.ops / threads;
+	steady_clock::time_point start = steady_clock::now();
+	vector<thread> pool;
+	for (unsigned int t = 0; t < threads; t++) {
+		pool.push_back(thread([&, t]() {
+			mt19937 rng(config.seed * 7919 + t);
+			for (size_t i = 0; i < perThread; i++) {
+				int key = rng() % config.keys;
+				if (static_cast<int>(rng() % 100) < readPercent) contains(key);
+				else insert(key);
+			}
+		}));
+	}
+	for (thread &t : pool) {
+		t.join();
+	}
+	return perThread * threads / duration<double>(steady_clock::now() - start).count();
+}
+
+// Bottom-up RedBlackTree behind a mutex against the lock-coupled
+// TopDownRedBlackTree, on the same insert/contains mixes
+void CompareTopDown(const StressConfig &config) {
+	cout << "ops per mix: " << config.ops << ", keys: " << config.keys
+		<< ", node bytes: bottom-up " << sizeof(RBTNode) << ", top-down " << sizeof(TopDownRBTNode) << endl;
+	cout << setw(8) << "threads" << setw(8) << "reads%" << setw(16) << "bottom-up/s" << setw(16) << "top-down/s" << endl;
+
+	for (int readPercent : config.readPercents) {
+		for (unsigned int threads : config.threads) {
+			RedBlackTree bottomUp = RedBlackTree();
+			mutex lock;
+			double bottomUpRate = RunInsertMix(config, threads, readPercent,
+				[&](int key) {
+					lock_guard<mutex> guard(lock);
+					if (!bottomUp.Contains(key)) bottomUp.Insert(key);
+				},
+				[&](int key) {
+					lock_guard<mutex> guard(lock);
+					volatile bool found = bottomUp.Contains(key);
+					(void)found;
+				});
+			ValidateOrDie(bottomUp);
+
+			TopDownRedBlackTree topDown;
+			double topDownRate = RunInsertMix(config, threads, readPercent,
+				[&](int key) {
+					if (topDown.Contains(key)) return;
+					try {
+						topDown.Insert(key);
+					} catch (invalid_argument &e) {
+						// Another thread got there first
+					}
+				},
+				[&](int key) {
+					volatile bool found = topDown.Contains(key);
+					(void)found;
+				});
+
+			string problem;
+			if (!topDown.Validate(&problem) || topDown.Size() != bottomUp.Size()) {
+				cerr << "INVARIANT VIOLATED: top-down tree " << (problem.empty() ? "holds different keys" : problem) << endl;
+				exit(1);
+			}
+
+			cout << setw(8) << threads << setw(8) << readPercent
+				<< setw(16) << fixed << setprecision(0) << bottomUpRate
+				<< setw(16) << topDownRate << endl;
+		}
+	}
+	cout << "ALL INVARIANTS HELD" << endl;
+}
+
+int main(int argc, char **argv) {
+	StressConfig config;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		string flag = argv[i];
+		string value = argv[i + 1];
+		if (flag == "--ops") config.ops = stoull(value);
+		else if (flag == "--threads") config.threads = ParseList<unsigned int>(value);
+		else if (flag == "--reads") config.readPercents = ParseList<int>(value);
+		else if (flag == "--keys") config.keys = stoi(value);
+		else if (flag == "--validate-every") config.validateEvery = stoull(value);
+		else if (flag == "--seed") config.seed = stoul(value);
+		else if (flag == "--arena") config.arena = value;
+		else if (flag == "--mode") config.mode = value;
+		else {
+			cerr << "Unknown option " << flag << endl;
+			return 2;
+		}
+	}
+
+	if (config.mode == "topdown") {
+		CompareTopDown(config);
+		return 0;
+	}
+	if (config.mode != "mixed") {
+		cerr << "Unknown mode " << config.mode << endl;
+		return 2;
+	}
+
+	cout << "ops per mix: " << config.ops << ", keys: " << config.keys << ", arena: " << config.arena << endl;
+	cout << setw(8) << "threads" << setw(8) << "reads%" << setw(14) << "ops/sec"
+		<< setw(10) << "p50 us" << setw(10) << "p99 us" << setw(10) << "p999 us"
+		<< setw(8) << "checks" << endl;
+
+	for (int readPercent : config.readPercents) {
+		for (unsigned int threads : config.threads) {
+			MixResult result = RunMix(config, threads, readPercent);
+			cout << setw(8) << threads << setw(8) << readPercent
+				<< setw(14) << fixed << setprecision(0) << result.opsPerSecond
+				<< setw(10) << setprecision(2) << result.p50
+				<< setw(10) << result.p99
+				<< setw(10) << result.p999
+				<< setw(8) << result.validations << endl;
+		}
+	}
+
+	cout << "ALL INVARIANTS HELD" << endl;
+	return 0;
+}
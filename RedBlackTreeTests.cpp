@@ -1,7 +1,29 @@
 #include <iostream>
 #include <cassert>
 #include <random>
+#include <thread>
+#include <chrono>
+#include <algorithm>
 #include "RedBlackTree.h"
+#include "IntervalTree.h"
+#include "DurableRedBlackTree.h"
+#include "StaticRedBlackTree.h"
+#include "SharedRedBlackTree.h"
+#include "HugePageResource.h"
+#include "CompressedIntSet.h"
+#include "BulkLoader.h"
+#include "KeySetServer.h"
+#include "TopDownRedBlackTree.h"
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <fstream>
+#include <cstdlib>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 using namespace std;
 
@@ -681,6 +703,1815 @@ void TestPrivateMethods() {
 	cout << "PASSED!" << endl << endl;
 }
 
+void TestStats() {
+	cout << "Testing Operation Stats..." << endl;
+
+	RedBlackTree::ResetStats();
+	RedBlackTree rbt = RedBlackTree();
+	rbt.Insert(30);
+	rbt.Insert(15);
+	rbt.Insert(10); // Left Left
+	assert(rbt.Contains(10));
+	assert(!rbt.Contains(99));
+	RedBlackTree copy = RedBlackTree(rbt);
+	assert(copy.Size() == 3);
+
+	RBTStats stats = RedBlackTree::Stats();
+#ifdef RBT_STATS
+	assert(stats.rightRotations == 1);
+	assert(stats.leftRotations == 0);
+	assert(stats.fixupLeftLeft == 1);
+	assert(stats.fixupRecolor == 0);
+	assert(stats.nodesAllocated == 6);
+	assert(stats.treeCopies == 1);
+
+	// Insert() also runs Contains() for the duplicate check
+	assert(stats.containsDepth[0] == 1);
+	assert(stats.containsDepth[1] == 2);
+	assert(stats.containsDepth[2] == 2);
+	assert(stats.insertDepth[1] == 1);
+	assert(stats.insertDepth[2] == 1);
+
+	// Counters from other threads are included, even after they exit
+	thread worker([]() {
+		RedBlackTree other = RedBlackTree();
+		other.Insert(1);
+		other.Insert(2);
+		other.Insert(3); // Right Right
+	});
+	worker.join();
+	stats = RedBlackTree::Stats();
+	assert(stats.leftRotations == 1);
+	assert(stats.fixupRightRight == 1);
+	assert(stats.nodesAllocated == 9);
+
+	RedBlackTree::ResetStats();
+	stats = RedBlackTree::Stats();
+	assert(stats.nodesAllocated == 0);
+	assert(stats.containsDepth[1] == 0);
+#else
+	// Compiled out: nothing is counted
+	assert(stats.rightRotations == 0);
+	assert(stats.nodesAllocated == 0);
+	assert(stats.containsDepth[0] == 0);
+#endif
+
+	cout << "PASSED!" << endl << endl;
+}
+
+void TestAnalyze() {
+	cout << "Testing Analyze..." << endl;
+
+	// Empty tree
+	RedBlackTree rbt = RedBlackTree();
+	RBTShape shape = rbt.Analyze();
+	assert(shape.nodes == 0);
+	assert(shape.blackHeight == 0);
+	assert(shape.nodeBytes == 0);
+
+	// B12  B7  R5  R11  B15  R13
+	rbt.Insert(12);
+	rbt.Insert(11);
+	rbt.Insert(15);
+	rbt.Insert(5);
+	rbt.Insert(13);
+	rbt.Insert(7);
+	shape = rbt.Analyze();
+	assert(shape.nodes == 6);
+	assert(shape.blackHeight == 2);
+	assert(shape.maxDepth == 2);
+	assert(shape.depthHistogram[0] == 1);
+	assert(shape.depthHistogram[1] == 2);
+	assert(shape.depthHistogram[2] == 3);
+	assert(shape.averageDepth == 8.0 / 6);
+	assert(shape.redRatio == 0.5);
+	assert(shape.nodeBytes == 6 * sizeof(RBTNode));
+	assert(shape.averageNeighborDistance > 0);
+	assert(shape.pageJumpRatio >= 0 && shape.pageJumpRatio <= 1);
+
+	// Larger tree: depth stays within 2 * log2(n + 1)
+	RedBlackTree big = RedBlackTree();
+	for (int i = 0; i < 1000; i++) {
+		big.Insert(i);
+	}
+	shape = big.Analyze();
+	assert(shape.nodes == 1000);
+	assert(shape.maxDepth < 20);
+	unsigned long long counted = 0;
+	for (int i = 0; i < RBT_DEPTH_BUCKETS; i++) {
+		counted += shape.depthHistogram[i];
+	}
+	assert(counted == 1000);
+
+	cout << "PASSED!" << endl << endl;
+}
+
+void TestInsertBuffer() {
+	cout << "Testing Insert Buffer..." << endl;
+
+	RedBlackTree rbt = RedBlackTree();
+	rbt.SetInsertBuffer(5);
+	rbt.Insert(3);
+	rbt.Insert(1);
+	rbt.Insert(4);
+
+	// Buffered keys are visible to queries before the merge
+	assert(rbt.Buffered() == 3);
+	assert(rbt.Size() == 3);
+	assert(rbt.Contains(1));
+	assert(rbt.Contains(3));
+	assert(rbt.Contains(4));
+	assert(!rbt.Contains(2));
+	assert(rbt.GetMin() == 1);
+	assert(rbt.GetMax() == 4);
+
+	// Duplicates are still rejected, whether buffered or not
+	try {
+		rbt.Insert(4);
+		assert(false);
+	} catch (invalid_argument &e) { }
+
+	// Filling the buffer merges it into a balanced tree
+	rbt.Insert(5);
+	rbt.Insert(2);
+	assert(rbt.Buffered() == 0);
+	assert(rbt.Size() == 5);
+	assert(rbt.ToPrefixString() == " B3  B1  R2  B4  R5 ");
+
+	// A full level comes out all black
+	RedBlackTree full = RedBlackTree();
+	full.SetInsertBuffer(7);
+	for (int i = 7; i >= 1; i--) {
+		full.Insert(i);
+	}
+	assert(full.ToPrefixString() == " B4  B2  B1  B3  B6  B5  B7 ");
+
+	// Mixed with a larger existing tree, and copied while keys are buffered
+	RedBlackTree big = RedBlackTree();
+	for (int i = 0; i < 200; i += 2) {
+		big.Insert(i);
+	}
+	big.SetInsertBuffer(64);
+	for (int i = 1; i < 200; i += 2) {
+		big.Insert(i);
+	}
+	RedBlackTree copy = RedBlackTree(big);
+	assert(copy.Buffered() == big.Buffered());
+	big.FlushInsertBuffer();
+	assert(big.Size() == 200);
+	assert(big.Buffered() == 0);
+	assert(big.GetMin() == 0);
+	assert(big.GetMax() == 199);
+	for (int i = 0; i < 200; i++) {
+		assert(big.Contains(i));
+		assert(copy.Contains(i));
+	}
+	assert(big.Analyze().nodes == 200);
+	assert(big.Analyze().maxDepth < 16);
+
+	// Turning the buffer off flushes it
+	copy.SetInsertBuffer(0);
+	assert(copy.Buffered() == 0);
+	assert(copy.ToInfixString() == big.ToInfixString());
+
+	// Ordered and structural reads merge the buffer themselves
+	RedBlackTree lazy = RedBlackTree();
+	lazy.Insert(10);
+	lazy.Insert(30);
+	lazy.SetInsertBuffer(100);
+	lazy.Insert(20);
+	lazy.Insert(5);
+	vector<int> seen;
+	lazy.ForEach([&seen](int data) { seen.push_back(data); });
+	assert(seen == vector<int>({5, 10, 20, 30}));
+	assert(lazy.Buffered() == 0);
+
+	lazy.Insert(25);
+	assert(lazy.ToInfixString().find("25") != string::npos);
+	assert(lazy.Buffered() == 0);
+
+	lazy.Insert(1);
+	assert(lazy.Analyze().nodes == 6);
+	lazy.Insert(40);
+	assert(lazy.ParallelReduce(0, [](int data) { return data; },
+		[](int a, int b) { return a + b; }, 2) == 131);
+	assert(lazy.Buffered() == 0);
+	assert(lazy.Validate());
+
+	cout << "PASSED!" << endl << endl;
+}
+
+void TestIntervalTree() {
+	cout << "Testing Interval Tree..." << endl;
+
+	IntervalTree it = IntervalTree();
+	assert(it.Overlapping(5).empty());
+
+	it.Insert(15, 20);
+	it.Insert(10, 30);
+	it.Insert(17, 19);
+	it.Insert(5, 20);
+	it.Insert(12, 15);
+	it.Insert(30, 40);
+	it.Insert(5, 6); // same low end as [5, 20]
+	assert(it.Size() == 7);
+
+	vector<pair<int, int> > hits = it.Overlapping(18);
+	assert(hits.size() == 4);
+	assert(hits[0].first == 5 && hits[0].second == 20);
+	assert(hits[1] == make_pair(10, 30));
+	assert(hits[2] == make_pair(15, 20));
+	assert(hits[3] == make_pair(17, 19));
+
+	// Closed ends touch
+	hits = it.Overlapping(40);
+	assert(hits.size() == 1 && hits[0] == make_pair(30, 40));
+	assert(it.Overlapping(41).empty());
+	assert(it.Overlapping(4).empty());
+
+	hits = it.Overlapping(6, 11);
+	assert(hits.size() == 3);
+	assert(hits[0].first == 5 && hits[1].first == 5);
+	assert(hits[2] == make_pair(10, 30));
+
+	// Bad interval
+	try {
+		it.Insert(3, 2);
+		assert(false);
+	} catch (invalid_argument &e) { }
+
+	// Compare against a brute force scan after plenty of rotations
+	mt19937 rng(7);
+	IntervalTree big = IntervalTree();
+	vector<pair<int, int> > all;
+	for (int i = 0; i < 500; i++) {
+		int low = rng() % 1000;
+		int high = low + rng() % 50;
+		big.Insert(low, high);
+		all.push_back(make_pair(low, high));
+	}
+	IntervalTree copy = IntervalTree(big);
+	for (int q = 0; q < 1050; q += 7) {
+		size_t expected = 0;
+		for (size_t i = 0; i < all.size(); i++) {
+			if (all[i].first <= q + 3 && all[i].second >= q) expected++;
+		}
+		hits = big.Overlapping(q, q + 3);
+		assert(hits.size() == expected);
+		for (size_t i = 1; i < hits.size(); i++) {
+			assert(hits[i - 1].first <= hits[i].first);
+		}
+		assert(copy.Overlapping(q, q + 3) == hits);
+	}
+
+	cout << "PASSED!" << endl << endl;
+}
+
+void TestRemove() {
+	cout << "Testing Remove..." << endl;
+
+	RedBlackTree rbt = RedBlackTree();
+	try {
+		rbt.Remove(1);
+		assert(false);
+	} catch (invalid_argument &e) { }
+
+	// B12  B7  R5  R11  B15  R13
+	rbt.Insert(12);
+	rbt.Insert(11);
+	rbt.Insert(15);
+	rbt.Insert(5);
+	rbt.Insert(13);
+	rbt.Insert(7);
+
+	// Red leaf
+	rbt.Remove(13);
+	assert(rbt.ToPrefixString() == " B12  B7  R5  R11  B15 ");
+
+	// Black leaf with a black sibling that has red children
+	rbt.Remove(15);
+	assert(rbt.ToPrefixString() == " B7  B5  B12  R11 ");
+
+	// Node with two children: successor takes its place
+	rbt.Remove(7);
+	assert(rbt.ToPrefixString() == " B11  B5  B12 ");
+	assert(rbt.Size() == 3);
+	assert(!rbt.Contains(7));
+	assert(rbt.GetMin() == 5);
+
+	rbt.Remove(11);
+	rbt.Remove(5);
+	rbt.Remove(12);
+	assert(rbt.Size() == 0);
+	assert(rbt.ToPrefixString() == "");
+
+	// Remove everything in a scrambled order, checking shape as we go
+	mt19937 rng(3);
+	vector<int> keys;
+	for (int i = 0; i < 512; i++) {
+		keys.push_back(i);
+	}
+	shuffle(keys.begin(), keys.end(), rng);
+	for (int k : keys) {
+		rbt.Insert(k);
+	}
+	shuffle(keys.begin(), keys.end(), rng);
+	for (size_t i = 0; i < keys.size(); i++) {
+		rbt.Remove(keys[i]);
+		assert(!rbt.Contains(keys[i]));
+		assert(rbt.Size() == keys.size() - i - 1);
+		if (i % 64 == 0) {
+			assert(rbt.Analyze().maxDepth <= 20);
+		}
+	}
+	assert(rbt.ToInfixString() == "");
+
+	// Buffered keys can be removed before they are merged
+	rbt.SetInsertBuffer(8);
+	rbt.Insert(1);
+	rbt.Insert(2);
+	rbt.Remove(1);
+	assert(rbt.Size() == 1);
+	assert(!rbt.Contains(1));
+	assert(rbt.Contains(2));
+
+	cout << "PASSED!" << endl << endl;
+}
+
+void TestMultiset() {
+	cout << "Testing Multiset Mode..." << endl;
+
+	RedBlackTree rbt = RedBlackTree();
+	rbt.SetMultiset(true);
+	rbt.Insert(30);
+	rbt.Insert(15);
+	rbt.Insert(30);
+	rbt.Insert(30);
+	rbt.Insert(10);
+
+	// Duplicates do not add nodes
+	assert(rbt.ToPrefixString() == " B15  R10  R30 ");
+	assert(rbt.Size() == 3);
+	assert(rbt.TotalSize() == 5);
+	assert(rbt.Count(30) == 3);
+	assert(rbt.Count(15) == 1);
+	assert(rbt.Count(99) == 0);
+
+	// Remove takes one occurrence at a time
+	rbt.Remove(30);
+	assert(rbt.Count(30) == 2);
+	assert(rbt.Size() == 3);
+	assert(rbt.TotalSize() == 4);
+	rbt.Remove(30);
+	rbt.Remove(30);
+	assert(rbt.Count(30) == 0);
+	assert(!rbt.Contains(30));
+	assert(rbt.Size() == 2);
+	assert(rbt.TotalSize() == 2);
+
+	// Counts survive a copy
+	rbt.Insert(10);
+	RedBlackTree copy = RedBlackTree(rbt);
+	assert(copy.Count(10) == 2);
+	assert(copy.TotalSize() == 3);
+
+	// Cannot leave multiset mode while duplicates are held
+	try {
+		rbt.SetMultiset(false);
+		assert(false);
+	} catch (invalid_argument &e) { }
+	rbt.Remove(10);
+	rbt.SetMultiset(false);
+	try {
+		rbt.Insert(10);
+		assert(false);
+	} catch (invalid_argument &e) { }
+
+	// Set mode counts
+	assert(rbt.Count(10) == 1);
+	assert(rbt.TotalSize() == rbt.Size());
+
+	cout << "PASSED!" << endl << endl;
+}
+
+void TestAssignment() {
+	cout << "Testing Assignment..." << endl;
+
+	RedBlackTree rbt1 = RedBlackTree();
+	rbt1.Insert(1);
+	rbt1.Insert(2);
+	rbt1.Insert(3);
+
+	RedBlackTree rbt2 = RedBlackTree(10);
+	rbt2 = rbt1;
+	assert(rbt2.ToPrefixString() == rbt1.ToPrefixString());
+	assert(rbt2.Size() == 3);
+	assert(!rbt2.Contains(10));
+
+	rbt1.Remove(2);
+	assert(rbt2.Contains(2));
+
+	rbt2 = rbt2;
+	assert(rbt2.Size() == 3);
+
+	cout << "PASSED!" << endl << endl;
+}
+
+void TestLoadSorted() {
+	cout << "Testing LoadSorted and ForEach..." << endl;
+
+	RedBlackTree rbt = RedBlackTree(99);
+	rbt.LoadSorted(vector<int>{1, 2, 3, 4, 5});
+	assert(rbt.ToPrefixString() == " B3  B1  R2  B4  R5 ");
+	assert(rbt.Size() == 5);
+	assert(!rbt.Contains(99));
+
+	vector<int> seen;
+	rbt.ForEach([&seen](int data) { seen.push_back(data); });
+	assert(seen == vector<int>({1, 2, 3, 4, 5}));
+
+	// Keys must be sorted and distinct
+	try {
+		rbt.LoadSorted(vector<int>{1, 3, 3});
+		assert(false);
+	} catch (invalid_argument &e) { }
+
+	rbt.LoadSorted(vector<int>());
+	assert(rbt.Size() == 0);
+	assert(rbt.ToPrefixString() == "");
+
+	cout << "PASSED!" << endl << endl;
+}
+
+void TestDurableTree() {
+	cout << "Testing Durable Tree..." << endl;
+
+	char dirTemplate[] = "/tmp/rbt-durable-XXXXXX";
+	string dir = mkdtemp(dirTemplate);
+
+	{
+		DurableRedBlackTree drbt(dir, 4);
+		for (int i = 0; i < 10; i++) {
+			drbt.Insert(i);
+		}
+		drbt.Remove(3);
+
+		// Duplicates and missing keys throw and are not logged
+		try {
+			drbt.Insert(5);
+			assert(false);
+		} catch (invalid_argument &e) { }
+		try {
+			drbt.Remove(3);
+			assert(false);
+		} catch (invalid_argument &e) { }
+		assert(drbt.LogRecords() == 11);
+	}
+
+	// Replay the log
+	vector<int> expected;
+	{
+		DurableRedBlackTree drbt(dir, 4);
+		assert(drbt.Tree().Size() == 9);
+		assert(!drbt.Tree().Contains(3));
+		assert(drbt.LogRecords() == 11);
+
+		drbt.Checkpoint();
+		assert(drbt.LogRecords() == 0);
+		drbt.Insert(3);
+		drbt.Remove(0);
+		drbt.Tree().ForEach([&expected](int data) { expected.push_back(data); });
+	}
+
+	// Checkpoint plus log tail; a torn record at the end is dropped
+	{
+		ofstream wal((dir + "/wal").c_str(), ios::binary | ios::app);
+		wal.write("I\x01", 2);
+	}
+	{
+		DurableRedBlackTree drbt(dir, 4);
+		vector<int> recovered;
+		drbt.Tree().ForEach([&recovered](int data) { recovered.push_back(data); });
+		assert(recovered == expected);
+		assert(drbt.LogRecords() == 2);
+		drbt.Insert(100);
+	}
+	{
+		DurableRedBlackTree drbt(dir, 4);
+		assert(drbt.Tree().Contains(100));
+		assert(drbt.Tree().Size() == 10);
+	}
+
+	// A group that never fills is still synced once maxDelay has passed
+	struct stat walStat;
+	{
+		DurableRedBlackTree drbt(dir, 64, chrono::milliseconds(5));
+		drbt.Checkpoint();
+		drbt.Insert(200);
+		drbt.Insert(201);
+		this_thread::sleep_for(chrono::milliseconds(200));
+		assert(stat((dir + "/wal").c_str(), &walStat) == 0 && walStat.st_size == 10);
+	}
+
+	// With no delay allowed, each record is on disk when Insert returns
+	{
+		DurableRedBlackTree drbt(dir, 64, chrono::milliseconds(0));
+		drbt.Insert(202);
+		assert(stat((dir + "/wal").c_str(), &walStat) == 0 && walStat.st_size == 15);
+		drbt.Remove(202);
+		assert(stat((dir + "/wal").c_str(), &walStat) == 0 && walStat.st_size == 20);
+	}
+	{
+		DurableRedBlackTree drbt(dir, 4);
+		assert(drbt.Tree().Contains(200) && drbt.Tree().Contains(201));
+		assert(!drbt.Tree().Contains(202));
+	}
+
+	remove((dir + "/wal").c_str());
+	remove((dir + "/checkpoint").c_str());
+	remove(dir.c_str());
+
+	cout << "PASSED!" << endl << endl;
+}
+
+void TestCompaction() {
+	cout << "Testing Compaction..." << endl;
+
+	// Scatter the nodes: interleave inserts with copies that allocate too
+	mt19937 rng(11);
+	vector<int> keys;
+	for (int i = 0; i < 2000; i++) {
+		keys.push_back(i);
+	}
+	shuffle(keys.begin(), keys.end(), rng);
+	RedBlackTree rbt = RedBlackTree();
+	vector<RedBlackTree> copies;
+	for (size_t i = 0; i < keys.size(); i++) {
+		rbt.Insert(keys[i]);
+		if (i % 500 == 0) {
+			copies.push_back(rbt);
+		}
+	}
+	string before = rbt.ToPrefixString();
+
+	// A full pass leaves in-order neighbours next to each other
+	rbt.Compact();
+	assert(rbt.ToPrefixString() == before);
+	RBTShape shape = rbt.Analyze();
+	assert(shape.averageNeighborDistance == sizeof(RBTNode));
+
+	// Interleave small steps with inserts and removes
+	int steps = 0;
+	int next = 2000;
+	while (!rbt.CompactStep(100)) {
+		steps++;
+		rbt.Insert(next++);
+		rbt.Insert(-next);
+		rbt.Remove(keys[steps]);
+	}
+	assert(steps > 10);
+	for (int s = 1; s <= steps; s++) {
+		assert(!rbt.Contains(keys[s]));
+	}
+	assert(rbt.Contains(keys[0]));
+	assert(rbt.Size() == size_t(2000 + steps));
+	assert(rbt.GetMax() == next - 1);
+	assert(rbt.GetMin() == -next);
+
+	// Copies and assignment of a compacted tree are independent
+	RedBlackTree copy = RedBlackTree(rbt);
+	rbt.Compact();
+	copy = rbt;
+	rbt.Remove(keys[0]);
+	assert(copy.Contains(keys[0]));
+	assert(copies[0].Size() == 1);
+
+	cout << "PASSED!" << endl << endl;
+}
+
+void TestParallel() {
+	cout << "Testing Parallel Traversal..." << endl;
+
+	RedBlackTree rbt = RedBlackTree();
+	assert(rbt.ParallelReduce(0LL, [](int data) { return (long long)data; },
+		[](long long a, long long b) { return a + b; }) == 0);
+
+	for (int i = 1; i <= 10000; i++) {
+		rbt.Insert(i);
+	}
+
+	// Sum and count-if with several thread counts
+	for (unsigned int threads : {1u, 2u, 3u, 8u, 0u}) {
+		long long sum = rbt.ParallelReduce(0LL, [](int data) { return (long long)data; },
+			[](long long a, long long b) { return a + b; }, threads);
+		assert(sum == 10000LL * 10001 / 2);
+
+		atomic<int> evens(0);
+		rbt.ParallelForEach([&evens](int data) {
+			if (data % 2 == 0) evens++;
+		}, threads);
+		assert(evens == 5000);
+
+		// bool partials must not share packed words between threads
+		bool any = rbt.ParallelReduce(false, [](int data) { return data == 7777; },
+			[](bool a, bool b) { return a || b; }, threads);
+		assert(any);
+		bool all = rbt.ParallelReduce(true, [](int data) { return data > 0; },
+			[](bool a, bool b) { return a && b; }, threads);
+		assert(all);
+		assert(!rbt.ParallelReduce(false, [](int data) { return data < 0; },
+			[](bool a, bool b) { return a || b; }, threads));
+	}
+
+	// Order-sensitive reduce: concatenation keeps key order
+	RedBlackTree small = RedBlackTree();
+	for (int i = 9; i >= 0; i--) {
+		small.Insert(i);
+	}
+	string digits = small.ParallelReduce(string(">"), [](int data) { return to_string(data); },
+		[](const string &a, const string &b) { return a + b; }, 4);
+	assert(digits == ">0123456789");
+
+	cout << "PASSED!" << endl << endl;
+}
+
+// Built entirely at compile time
+constexpr int staticKeys[] = {12, 11, 15, 5, 13, 7};
+constexpr StaticRedBlackTree<6> staticTree(staticKeys);
+static_assert(staticTree.Size() == 6);
+static_assert(staticTree.Contains(13));
+static_assert(!staticTree.Contains(14));
+static_assert(staticTree.GetMin() == 5);
+static_assert(staticTree.GetMax() == 15);
+
+constexpr int staticSorted[] = {10, 20, 30, 40, 50, 60, 70, 80, 90};
+constexpr StaticRedBlackTree<9> staticSortedTree(staticSorted);
+static_assert(staticSortedTree.Contains(90));
+
+void TestStaticTree() {
+	cout << "Testing Static Tree..." << endl;
+
+	// Same shape as the run-time tree built with the same inserts
+	assert(staticTree.ToPrefixString() == " B12  B7  R5  R11  B15  R13 ");
+	RedBlackTree rbt = RedBlackTree();
+	for (int key : staticSorted) {
+		rbt.Insert(key);
+	}
+	assert(staticSortedTree.ToPrefixString() == rbt.ToPrefixString());
+
+	// Also usable at run time
+	mt19937 rng(13);
+	int keys[200];
+	for (int i = 0; i < 200; i++) {
+		keys[i] = i * 3;
+	}
+	shuffle(keys, keys + 200, rng);
+	StaticRedBlackTree<200> runtimeTree(keys);
+	RedBlackTree same = RedBlackTree();
+	for (int key : keys) {
+		same.Insert(key);
+	}
+	assert(runtimeTree.ToPrefixString() == same.ToPrefixString());
+	assert(runtimeTree.Contains(297));
+	assert(!runtimeTree.Contains(298));
+
+	// Duplicates throw (and fail to compile in a constant expression)
+	int duplicate[] = {1, 2, 1};
+	try {
+		StaticRedBlackTree<3> bad(duplicate);
+		assert(false);
+	} catch (invalid_argument &e) { }
+
+	cout << "PASSED!" << endl << endl;
+}
+
+// Counts what passes through it on the way to new/delete
+class CountingResource : public pmr::memory_resource {
+	public:
+		size_t allocations = 0;
+		size_t deallocations = 0;
+		size_t bytesInUse = 0;
+
+	private:
+		void *do_allocate(size_t bytes, size_t alignment) override {
+			allocations++;
+			bytesInUse += bytes;
+			return pmr::new_delete_resource()->allocate(bytes, alignment);
+		}
+		void do_deallocate(void *p, size_t bytes, size_t alignment) override {
+			deallocations++;
+			bytesInUse -= bytes;
+			pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+		}
+		bool do_is_equal(const pmr::memory_resource &other) const noexcept override {
+			return this == &other;
+		}
+};
+
+// Bump allocator over a fixed buffer that never reuses memory; it only
+// counts the frees it is asked for
+class BumpArena : public pmr::memory_resource {
+	public:
+		size_t deallocations = 0;
+
+	private:
+		alignas(64) char buffer[16 * 1024];
+		size_t used = 0;
+
+		void *do_allocate(size_t bytes, size_t alignment) override {
+			used = (used + alignment - 1) / alignment * alignment;
+			if (used + bytes > sizeof(buffer)) throw bad_alloc();
+			void *p = buffer + used;
+			used += bytes;
+			return p;
+		}
+		void do_deallocate(void *, size_t, size_t) override {
+			deallocations++;
+		}
+		bool do_is_equal(const pmr::memory_resource &other) const noexcept override {
+			return this == &other;
+		}
+};
+
+void TestMemoryResource() {
+	cout << "Testing Memory Resource..." << endl;
+
+	CountingResource counting;
+	{
+		RedBlackTree rbt = RedBlackTree(&counting);
+		assert(rbt.Resource() == &counting);
+		for (int i = 0; i < 10; i++) {
+			rbt.Insert(i);
+		}
+		assert(counting.allocations == 10);
+		assert(counting.bytesInUse == 10 * sizeof(RBTNode));
+
+		// Copies (and their CopyOf) use the source's resource
+		RedBlackTree copy = RedBlackTree(rbt);
+		assert(copy.Resource() == &counting);
+		assert(counting.allocations == 20);
+
+		// ...or one of their own
+		RedBlackTree elsewhere = RedBlackTree(rbt, pmr::new_delete_resource());
+		assert(counting.allocations == 20);
+		assert(elsewhere.ToPrefixString() == rbt.ToPrefixString());
+
+		rbt.Remove(3);
+		assert(counting.deallocations == 1);
+
+		// Compaction blocks too, and the list that tracks them
+		rbt.Compact();
+		assert(counting.allocations == 22);
+		assert(counting.deallocations == 10);
+
+		// So do the insert buffer, the lookup cache and the Bloom filter
+		rbt.SetInsertBuffer(4);
+		rbt.SetLookupCache(64);
+		rbt.EnableBloomFilter();
+		assert(counting.allocations == 25);
+		rbt.Insert(100);
+		rbt.Insert(101);
+		assert(rbt.ToInfixString().find("101") != string::npos);
+	}
+	assert(counting.bytesInUse == 0);
+	assert(counting.allocations == counting.deallocations);
+
+	// A per-request arena: nothing is freed one node at a time
+	char buffer[64 * 1024];
+	pmr::monotonic_buffer_resource arena(buffer, sizeof(buffer), &counting);
+	{
+		RedBlackTree rbt = RedBlackTree(&arena, false);
+		for (int i = 0; i < 100; i++) {
+			rbt.Insert(i);
+		}
+		assert(rbt.Size() == 100);
+		assert(rbt.GetMax() == 99);
+	}
+	assert(counting.allocations == counting.deallocations);
+	arena.release();
+
+	// Any arena can opt out of the per-node frees, and copies inherit that
+	BumpArena bump;
+	{
+		RedBlackTree rbt = RedBlackTree(&bump, false);
+		for (int i = 0; i < 10; i++) {
+			rbt.Insert(i);
+		}
+		rbt.Remove(0);
+		RedBlackTree copy = RedBlackTree(rbt);
+		assert(copy.ToInfixString() == rbt.ToInfixString());
+	}
+	assert(bump.deallocations == 1);
+
+	cout << "PASSED!" << endl << endl;
+}
+
+void TestSharedTree() {
+	cout << "Testing Shared Tree..." << endl;
+
+	string name = "/rbt-tests-" + to_string(getpid());
+	SharedRedBlackTree writer = SharedRedBlackTree::Create(name, 100);
+	assert(writer.Size() == 0);
+	assert(!writer.Contains(1));
+	try {
+		writer.GetMin();
+		assert(false);
+	} catch (invalid_argument &e) { }
+
+	RedBlackTree rbt = RedBlackTree();
+	for (int i = 0; i < 50; i++) {
+		rbt.Insert(i * 2);
+	}
+	writer.Publish(rbt);
+
+	// A second mapping sees the same single copy
+	SharedRedBlackTree reader = SharedRedBlackTree::Attach(name);
+	assert(reader.Size() == 50);
+	assert(reader.Capacity() == 100);
+	assert(reader.Contains(48));
+	assert(!reader.Contains(49));
+	assert(reader.GetMin() == 0);
+	assert(reader.GetMax() == 98);
+
+	// ...and so does another process
+	pid_t child = fork();
+	if (child == 0) {
+		SharedRedBlackTree other = SharedRedBlackTree::Attach(name);
+		bool ok = other.Size() == 50 && other.Contains(96) && !other.Contains(97) && other.GetMax() == 98;
+		_exit(ok ? 0 : 1);
+	}
+	int status = 0;
+	waitpid(child, &status, 0);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	// Republishing replaces what readers see
+	rbt.Insert(1000);
+	writer.Publish(rbt);
+	assert(reader.Contains(1000));
+	assert(reader.GetMax() == 1000);
+
+	// Too big for the segment
+	for (int i = 0; i < 60; i++) {
+		rbt.Insert(-i - 1);
+	}
+	try {
+		writer.Publish(rbt);
+		assert(false);
+	} catch (invalid_argument &e) { }
+	assert(reader.Size() == 51);
+
+	SharedRedBlackTree::Unlink(name);
+	try {
+		SharedRedBlackTree::Attach(name);
+		assert(false);
+	} catch (runtime_error &e) { }
+
+	cout << "PASSED!" << endl << endl;
+}
+
+void TestEqualityAndDiff() {
+	cout << "Testing Equality, Hash and Diff..." << endl;
+
+	// Same keys, different shapes
+	RedBlackTree rbt1 = RedBlackTree();
+	RedBlackTree rbt2 = RedBlackTree();
+	for (int i = 0; i < 100; i++) {
+		rbt1.Insert(i);
+		rbt2.Insert(99 - i);
+	}
+	assert(rbt1.ToPrefixString() != rbt2.ToPrefixString());
+	assert(rbt1.Hash() == rbt2.Hash());
+	assert(rbt1 == rbt2);
+
+	RedBlackTree empty1 = RedBlackTree();
+	RedBlackTree empty2 = RedBlackTree();
+	assert(empty1 == empty2);
+	assert(empty1 != rbt1);
+
+	// Hashes follow inserts, removes, rebuilds and compaction
+	rbt1.Remove(50);
+	assert(rbt1 != rbt2);
+	rbt1.Insert(50);
+	assert(rbt1.Hash() == rbt2.Hash());
+	rbt1.Compact();
+	vector<int> all;
+	rbt2.ForEach([&all](int data) { all.push_back(data); });
+	RedBlackTree loaded = RedBlackTree();
+	loaded.LoadSorted(all);
+	assert(loaded == rbt1);
+	assert(loaded.Hash() == rbt1.Hash());
+
+	// Buffered keys count too
+	RedBlackTree buffered = RedBlackTree();
+	buffered.SetInsertBuffer(1000);
+	for (int i = 0; i < 100; i++) {
+		buffered.Insert(i);
+	}
+	assert(buffered.Hash() == rbt1.Hash());
+	assert(buffered == rbt1);
+
+	// Diff only reports what differs
+	vector<int> onlyIn1, onlyIn2;
+	RedBlackTree::Diff(rbt1, rbt2, onlyIn1, onlyIn2);
+	assert(onlyIn1.empty() && onlyIn2.empty());
+
+	rbt1.Remove(7);
+	rbt1.Insert(-5);
+	rbt2.Remove(93);
+	rbt2.Insert(1000);
+	rbt2.Insert(INT_MIN);
+	RedBlackTree::Diff(rbt1, rbt2, onlyIn1, onlyIn2);
+	assert(onlyIn1 == vector<int>({-5, 93}));
+	assert(onlyIn2 == vector<int>({INT_MIN, 7, 1000}));
+
+	// Multiset counts are part of the comparison
+	RedBlackTree multi1 = RedBlackTree();
+	RedBlackTree multi2 = RedBlackTree();
+	multi1.SetMultiset(true);
+	multi2.SetMultiset(true);
+	multi1.Insert(4);
+	multi1.Insert(4);
+	multi2.Insert(4);
+	assert(multi1 != multi2);
+	multi2.Insert(4);
+	assert(multi1 == multi2);
+	multi1.Insert(4);
+	onlyIn1.clear();
+	onlyIn2.clear();
+	RedBlackTree::Diff(multi1, multi2, onlyIn1, onlyIn2);
+	assert(onlyIn1 == vector<int>({4}) && onlyIn2.empty());
+	multi1.Remove(4);
+	assert(multi1 == multi2);
+
+	cout << "PASSED!" << endl << endl;
+}
+
+void TestNearestKeys() {
+	cout << "Testing Nearest Key Queries..." << endl;
+
+	RedBlackTree rbt = RedBlackTree();
+	int out = -1;
+	assert(!rbt.Floor(5, out));
+	assert(!rbt.Ceiling(5, out));
+	assert(rbt.NextK(5, 3, &out) == 0);
+
+	for (int i = 10; i <= 100; i += 10) {
+		rbt.Insert(i);
+	}
+
+	assert(rbt.Floor(35, out) && out == 30);
+	assert(rbt.Floor(30, out) && out == 30);
+	assert(!rbt.Floor(9, out));
+	assert(rbt.Ceiling(35, out) && out == 40);
+	assert(rbt.Ceiling(40, out) && out == 40);
+	assert(!rbt.Ceiling(101, out));
+
+	assert(rbt.Predecessor(30, out) && out == 20);
+	assert(!rbt.Predecessor(10, out));
+	assert(rbt.Successor(30, out) && out == 40);
+	assert(rbt.Successor(5, out) && out == 10);
+	assert(!rbt.Successor(100, out));
+	assert(!rbt.Predecessor(INT_MIN, out));
+	assert(!rbt.Successor(INT_MAX, out));
+
+	// Next k keys strictly after x
+	int next[10];
+	assert(rbt.NextK(35, 3, next) == 3);
+	assert(next[0] == 40 && next[1] == 50 && next[2] == 60);
+	assert(rbt.NextK(40, 3, next) == 3);
+	assert(next[0] == 50);
+	assert(rbt.NextK(85, 10, next) == 2);
+	assert(next[0] == 90 && next[1] == 100);
+	assert(rbt.NextK(0, 10, next) == 10);
+	assert(next[9] == 100);
+	assert(rbt.NextK(100, 10, next) == 0);
+
+	// Buffered keys are seen by the point queries
+	rbt.SetInsertBuffer(10);
+	rbt.Insert(33);
+	assert(rbt.Floor(35, out) && out == 33);
+	assert(rbt.Ceiling(31, out) && out == 33);
+	assert(rbt.Predecessor(40, out) && out == 33);
+
+	// NextK interleaves buffered keys with merged ones
+	rbt.Insert(31);
+	rbt.Insert(47);
+	assert(rbt.Buffered() == 3);
+	assert(rbt.NextK(29, 6, next) == 6);
+	assert(next[0] == 30 && next[1] == 31 && next[2] == 33);
+	assert(next[3] == 40 && next[4] == 47 && next[5] == 50);
+	assert(rbt.Buffered() == 0);
+
+	// So does Diff, rather than refusing buffered trees
+	RedBlackTree other = RedBlackTree(rbt);
+	other.SetInsertBuffer(10);
+	other.Insert(32);
+	other.Remove(47);
+	vector<int> onlyInRbt, onlyInOther;
+	RedBlackTree::Diff(rbt, other, onlyInRbt, onlyInOther);
+	assert(onlyInRbt == vector<int>({47}));
+	assert(onlyInOther == vector<int>({32}));
+
+	cout << "PASSED!" << endl << endl;
+}
+
+void TestValidate() {
+	cout << "Testing Validate..." << endl;
+
+	RedBlackTree rbt = RedBlackTree();
+	assert(rbt.Validate());
+
+	// Random inserts and removes in every mode keep the invariants
+	mt19937 rng(17);
+	for (int mode = 0; mode < 3; mode++) {
+		rbt = RedBlackTree();
+		if (mode == 1) rbt.SetMultiset(true);
+		if (mode == 2) rbt.SetInsertBuffer(16);
+		for (int i = 0; i < 5000; i++) {
+			int key = rng() % 500;
+			try {
+				if (rng() % 3 == 0) {
+					rbt.Remove(key);
+				} else {
+					rbt.Insert(key);
+				}
+			} catch (invalid_argument &e) { }
+			if (i % 250 == 0) {
+				string problem;
+				assert(rbt.Validate(&problem));
+				assert(problem.empty());
+			}
+		}
+		rbt.Compact();
+		assert(rbt.Validate());
+	}
+
+	cout << "PASSED!" << endl << endl;
+}
+
+void TestHugePageResource() {
+	cout << "Testing Huge Page Resource..." << endl;
+
+	assert(HugePageResource::NumaNodes() >= 1);
+
+	HugePageResource arena = HugePageResource(4 * HugePageResource::HugePageSize);
+	{
+		RedBlackTree rbt = RedBlackTree(&arena);
+		for (int i = 0; i < 10000; i++) {
+			rbt.Insert(i);
+		}
+		assert(rbt.Validate());
+		assert(rbt.Contains(9999));
+
+		// One arena holds all of them, in whole huge pages
+		assert(arena.Arenas() == 1);
+		assert(arena.BytesMapped() == 4 * HugePageResource::HugePageSize);
+
+		// Freed nodes are reused before the arena grows
+		for (int i = 0; i < 5000; i++) {
+			rbt.Remove(i);
+		}
+		for (int i = 0; i < 5000; i++) {
+			rbt.Insert(-i - 1);
+		}
+		assert(arena.Arenas() == 1);
+
+		// Outgrowing an arena maps another
+		RedBlackTree big = RedBlackTree(&arena);
+		for (int i = 0; i < 200000; i++) {
+			big.Insert(i);
+		}
+		assert(arena.Arenas() > 1);
+		assert(big.Validate());
+	}
+
+	// Binding to an offline node is refused up front
+	bool thrown = false;
+	try {
+		HugePageResource offline = HugePageResource(HugePageResource::HugePageSize, NumaPolicy::Bind, HugePageResource::NumaNodes());
+	} catch (invalid_argument &e) {
+		thrown = true;
+	}
+	assert(thrown);
+
+	// Bound and interleaved arenas (the kernel may refuse mbind in a sandbox)
+	for (NumaPolicy policy : {NumaPolicy::Bind, NumaPolicy::Interleave}) {
+		HugePageResource placed = HugePageResource(HugePageResource::HugePageSize, policy, 0);
+		try {
+			RedBlackTree rbt = RedBlackTree(&placed);
+			for (int i = 0; i < 1000; i++) {
+				rbt.Insert(i);
+			}
+			assert(rbt.Validate());
+		} catch (runtime_error &e) {
+			cout << "NUMA placement unavailable: " << e.what() << endl;
+		}
+	}
+
+	cout << "PASSED!" << endl << endl;
+}
+
+void TestLookupCache() {
+	cout << "Testing Lookup Cache..." << endl;
+
+	RedBlackTree rbt = RedBlackTree();
+	for (int i = 0; i < 1000; i += 2) {
+		rbt.Insert(i);
+	}
+	rbt.SetLookupCache(100);
+
+	// Hot keys hit after the first probe, including remembered misses
+	for (int round = 0; round < 10; round++) {
+		assert(rbt.Contains(10));
+		assert(!rbt.Contains(11));
+	}
+	assert(rbt.LookupCacheStats().misses == 2);
+	assert(rbt.LookupCacheStats().hits == 18);
+
+	// Insert and Remove never leave a stale answer behind
+	unsigned long long version = rbt.Version();
+	rbt.Insert(11);
+	assert(rbt.Contains(11));
+	rbt.Remove(10);
+	assert(!rbt.Contains(10));
+	assert(rbt.Version() == version + 2);
+
+	// Nor do bulk replacement, buffered inserts or multiset counts
+	rbt.LoadSorted({1, 2, 3});
+	assert(!rbt.Contains(11));
+	assert(rbt.Contains(2));
+	rbt.SetInsertBuffer(4);
+	assert(!rbt.Contains(7));
+	rbt.Insert(7);
+	assert(rbt.Contains(7));
+	rbt.Remove(7);
+	assert(!rbt.Contains(7));
+	rbt.SetInsertBuffer(0);
+	rbt.SetMultiset(true);
+	rbt.Insert(3);
+	rbt.Remove(3);
+	assert(rbt.Contains(3));
+	rbt.Remove(3);
+	assert(!rbt.Contains(3));
+
+	// Agrees with the uncached tree on a random workload
+	mt19937 rng(41);
+	RedBlackTree cached = RedBlackTree();
+	RedBlackTree plain = RedBlackTree();
+	cached.SetLookupCache(16);
+	for (int i = 0; i < 20000; i++) {
+		int key = rng() % 64;
+		if (rng() % 4 == 0) {
+			if (plain.Contains(key)) {
+				plain.Remove(key);
+				cached.Remove(key);
+			} else {
+				plain.Insert(key);
+				cached.Insert(key);
+			}
+		}
+		assert(cached.Contains(key) == plain.Contains(key));
+	}
+	assert(cached.LookupCacheStats().hits > 0);
+
+	// Copies get an empty cache of the same size
+	RedBlackTree copy = RedBlackTree(cached);
+	assert(copy.Contains(plain.GetMin()));
+	assert(copy.LookupCacheStats().misses == 1);
+
+	// Per-thread caches over a shared, read-only tree
+	RedBlackTree shared = RedBlackTree();
+	for (int i = 0; i < 100; i++) {
+		shared.Insert(i * 3);
+	}
+	vector<thread> readers;
+	vector<RBTCacheStats> results(4);
+	for (int t = 0; t < 4; t++) {
+		readers.push_back(thread([&shared, &results, t]() {
+			RBTLookupCache local = RBTLookupCache(shared, 64);
+			for (int i = 0; i < 1000; i++) {
+				int key = i % 8;
+				assert(local.Contains(key) == (key % 3 == 0));
+			}
+			results[t] = local.Stats();
+		}));
+	}
+	for (thread &reader : readers) {
+		reader.join();
+	}
+	for (RBTCacheStats &stats : results) {
+		assert(stats.misses == 8);
+		assert(stats.hits == 992);
+	}
+
+	// ...which notice when the tree changes
+	RBTLookupCache local = RBTLookupCache(shared);
+	assert(!local.Contains(1));
+	shared.Insert(1);
+	assert(local.Contains(1));
+	assert(local.Stats().misses == 2);
+
+	cout << "PASSED!" << endl << endl;
+}
+
+void TestBloomFilter() {
+	cout << "Testing Bloom Filter..." << endl;
+
+	RedBlackTree rbt = RedBlackTree();
+	assert(rbt.MayContain(5));
+	assert(rbt.BloomFalsePositiveRate() == 1);
+	for (int i = 0; i < 20000; i += 2) {
+		rbt.Insert(i);
+	}
+	rbt.EnableBloomFilter(0.01);
+	assert(rbt.BloomBytes() > 0 && rbt.BloomBytes() % 64 == 0);
+	assert(rbt.BloomFalsePositiveRate() < 0.01);
+
+	// No false negatives, and about the target rate of false positives
+	size_t falsePositives = 0;
+	for (int i = 0; i < 20000; i++) {
+		if (i < 10000) assert(rbt.MayContain(i * 2));
+		assert(rbt.Contains(i * 2) == (i < 10000));
+		if (rbt.MayContain(i * 2 + 1)) falsePositives++;
+		assert(!rbt.Contains(i * 2 + 1));
+	}
+	assert(falsePositives < 20000 * 0.03);
+
+	// Growth rebuilds it before the rate drifts far from the target
+	size_t small = rbt.BloomBytes();
+	for (int i = 20000; i < 200000; i += 2) {
+		rbt.Insert(i);
+	}
+	assert(rbt.BloomBytes() > small);
+	assert(rbt.BloomFalsePositiveRate() <= 0.02);
+	assert(rbt.Validate());
+	for (int i = 0; i < 200000; i += 2) {
+		assert(rbt.MayContain(i));
+	}
+
+	// Removed keys stop passing once the filter is rebuilt
+	for (int i = 0; i < 200000; i += 2) {
+		rbt.Remove(i);
+		assert(!rbt.Contains(i));
+	}
+	size_t stale = 0;
+	for (int i = 0; i < 200000; i += 2) {
+		if (rbt.MayContain(i)) stale++;
+	}
+	assert(stale < 2000);
+	assert(rbt.Validate());
+
+	// The memory budget caps the filter, at the cost of its rate
+	RedBlackTree capped = RedBlackTree();
+	capped.EnableBloomFilter(0.001, 4096);
+	for (int i = 0; i < 50000; i++) {
+		capped.Insert(i);
+	}
+	assert(capped.BloomBytes() <= 4096);
+	assert(capped.Contains(49999) && !capped.Contains(50000));
+	assert(capped.Validate());
+
+	// Rebuilds triggered inside multiset and evicting inserts count right
+	RedBlackTree counted = RedBlackTree();
+	counted.SetMultiset(true);
+	counted.EnableBloomFilter();
+	for (int i = 0; i < 5000; i++) {
+		counted.Insert(i % 3000);
+	}
+	assert(counted.Validate());
+	RedBlackTree evicting = RedBlackTree();
+	evicting.EnableBloomFilter();
+	evicting.SetCapacity(1500);
+	for (int i = 0; i < 20000; i++) {
+		evicting.Insert(i);
+	}
+	assert(evicting.Validate());
+
+	// Buffered, bulk-loaded, multiset and copied trees keep it consistent
+	RedBlackTree mixed = RedBlackTree();
+	mixed.EnableBloomFilter();
+	mixed.SetInsertBuffer(8);
+	mixed.Insert(3);
+	assert(mixed.Contains(3));
+	mixed.LoadSorted({10, 20, 30});
+	assert(mixed.Contains(20) && !mixed.Contains(3));
+	mixed.SetMultiset(true);
+	mixed.Insert(40);
+	mixed.Insert(40);
+	assert(mixed.Contains(40));
+	RedBlackTree copy = RedBlackTree(mixed);
+	assert(copy.BloomBytes() == mixed.BloomBytes());
+	assert(copy.Contains(40) && copy.Contains(10));
+
+	mixed.DisableBloomFilter();
+	assert(mixed.BloomBytes() == 0);
+	assert(mixed.Contains(30));
+
+	bool thrown = false;
+	try {
+		mixed.EnableBloomFilter(1.5);
+	} catch (invalid_argument &e) {
+		thrown = true;
+	}
+	assert(thrown);
+
+	cout << "PASSED!" << endl << endl;
+}
+
+void TestBoundedCapacity() {
+	cout << "Testing Bounded Capacity..." << endl;
+
+	// Keep the 100 largest of a stream
+	CountingResource counting;
+	RedBlackTree top = RedBlackTree(&counting);
+	top.SetCapacity(100);
+	assert(top.Capacity() == 100);
+	mt19937 rng(43);
+	vector<int> stream;
+	for (int i = 0; i < 20000; i++) {
+		stream.push_back(rng() % 1000000);
+	}
+	sort(stream.begin(), stream.end());
+	stream.erase(unique(stream.begin(), stream.end()), stream.end());
+	shuffle(stream.begin(), stream.end(), rng);
+
+	for (size_t i = 0; i < stream.size(); i++) {
+		top.Insert(stream[i]);
+		assert(top.Size() == min<size_t>(i + 1, 100));
+	}
+	assert(top.Validate());
+
+	// Steady state evicts into the old node rather than allocating
+	assert(counting.allocations == 100);
+
+	vector<int> expected(stream);
+	sort(expected.begin(), expected.end());
+	expected.erase(expected.begin(), expected.end() - 100);
+	vector<int> kept;
+	top.ForEach([&kept](int data) { kept.push_back(data); });
+	assert(kept == expected);
+	assert(top.GetMin() == expected.front());
+
+	// Keys below the boundary are dropped; a duplicate above it still throws
+	top.Insert(expected.front() - 1);
+	assert(!top.Contains(expected.front() - 1));
+	bool thrown = false;
+	try {
+		top.Insert(expected.back());
+	} catch (invalid_argument &e) {
+		thrown = true;
+	}
+	assert(thrown);
+	thrown = false;
+	try {
+		top.Insert(expected.front());
+	} catch (invalid_argument &e) {
+		thrown = true;
+	}
+	assert(thrown);
+
+	// Removing the boundary moves it up; below a full tree anything goes in
+	top.Remove(expected.front());
+	assert(top.GetMin() == expected[1]);
+	top.Insert(-1);
+	assert(top.Contains(-1) && top.Size() == 100);
+	top.Insert(-2);
+	assert(!top.Contains(-2));
+	assert(top.Validate());
+
+	// Evicting the maximum keeps the smallest
+	RedBlackTree bottom = RedBlackTree();
+	bottom.SetCapacity(3, false);
+	for (int i = 10; i > 0; i--) {
+		bottom.Insert(i);
+	}
+	bottom.Insert(20);
+	assert(bottom.Size() == 3);
+	assert(bottom.GetMin() == 1 && bottom.GetMax() == 3);
+
+	// Shrinking trims right away, and LoadSorted respects the bound
+	top.SetCapacity(10);
+	assert(top.Size() == 10);
+	assert(top.GetMax() == expected.back());
+	assert(top.GetMin() == expected[90]);
+	top.LoadSorted({1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12});
+	assert(top.Size() == 10);
+	assert(top.GetMin() == 3);
+	top.SetCapacity(0);
+	top.Insert(1);
+	assert(top.Size() == 11);
+
+	// An eviction partway through a compaction pass must not leave the new
+	// key in a retired block behind the cursor
+	vector<int> sorted;
+	for (int i = 0; i < 1000; i += 10) {
+		sorted.push_back(i);
+	}
+	RedBlackTree compacted = RedBlackTree();
+	compacted.LoadSorted(sorted);
+	compacted.SetCapacity(100, false);
+	assert(!compacted.CompactStep(50));
+	compacted.Insert(5);
+	compacted.Compact();
+	assert(compacted.Validate());
+	assert(compacted.Contains(5) && !compacted.Contains(990));
+
+	thrown = false;
+	try {
+		bottom.SetMultiset(true);
+	} catch (invalid_argument &e) {
+		thrown = true;
+	}
+	assert(thrown);
+
+	cout << "PASSED!" << endl << endl;
+}
+
+void TestCompressedIntSet() {
+	cout << "Testing Compressed Int Set..." << endl;
+
+	CompressedIntSet empty = CompressedIntSet();
+	assert(empty.Size() == 0);
+	assert(!empty.Contains(0));
+
+	// Random inserts and removes agree with a RedBlackTree
+	CompressedIntSet set = CompressedIntSet(32);
+	RedBlackTree rbt = RedBlackTree();
+	mt19937 rng(44);
+	for (int i = 0; i < 20000; i++) {
+		int key = static_cast<int>(rng() % 20000) - 10000;
+		if (rbt.Contains(key)) {
+			set.Remove(key);
+			rbt.Remove(key);
+		} else {
+			set.Insert(key);
+			rbt.Insert(key);
+		}
+	}
+	assert(set.Size() == rbt.Size());
+	assert(set.Blocks() > 1);
+	assert(set.GetMin() == rbt.GetMin());
+	assert(set.GetMax() == rbt.GetMax());
+	for (int key = -10010; key < 10010; key++) {
+		assert(set.Contains(key) == rbt.Contains(key));
+	}
+	vector<int> fromSet, fromTree;
+	set.ForEach([&fromSet](int data) { fromSet.push_back(data); });
+	rbt.ForEach([&fromTree](int data) { fromTree.push_back(data); });
+	assert(fromSet == fromTree);
+
+	// Extreme gaps and duplicates
+	CompressedIntSet wide = CompressedIntSet();
+	wide.Insert(INT_MAX);
+	wide.Insert(INT_MIN);
+	wide.Insert(0);
+	assert(wide.Contains(INT_MIN) && wide.Contains(0) && wide.Contains(INT_MAX));
+	assert(wide.GetMin() == INT_MIN && wide.GetMax() == INT_MAX);
+	bool thrown = false;
+	try {
+		wide.Insert(0);
+	} catch (invalid_argument &e) {
+		thrown = true;
+	}
+	assert(thrown);
+	thrown = false;
+	try {
+		wide.Remove(1);
+	} catch (invalid_argument &e) {
+		thrown = true;
+	}
+	assert(thrown);
+
+	// Dense IDs take a few bytes each rather than a node apiece
+	CompressedIntSet dense = CompressedIntSet();
+	for (int i = 0; i < 100000; i++) {
+		dense.Insert(i * 3);
+	}
+	assert(dense.Size() == 100000);
+	assert(dense.Contains(299997) && !dense.Contains(299998));
+	assert(dense.MemoryBytes() < 100000 * 4);
+
+	cout << "PASSED!" << endl << endl;
+}
+
+void TestBulkLoader() {
+	cout << "Testing Bulk Loader..." << endl;
+
+	// Radix sort matches std::sort, negatives included, on any thread count
+	mt19937 rng(45);
+	vector<int> keys;
+	for (int i = 0; i < 100000; i++) {
+		keys.push_back(static_cast<int>(rng()));
+	}
+	keys.push_back(INT_MIN);
+	keys.push_back(INT_MAX);
+	for (unsigned int threads : {1u, 3u, 8u}) {
+		vector<int> sorted(keys);
+		ParallelRadixSort(sorted, threads);
+		vector<int> expected(keys);
+		sort(expected.begin(), expected.end());
+		assert(sorted == expected);
+	}
+
+	// Keys sharing their upper bytes take the skipped-pass path
+	vector<int> narrow;
+	for (int i = 0; i < 100000; i++) {
+		narrow.push_back(1000000 + static_cast<int>(rng() % 256));
+	}
+	for (unsigned int threads : {1u, 8u}) {
+		vector<int> sorted(narrow);
+		ParallelRadixSort(sorted, threads);
+		vector<int> expected(narrow);
+		sort(expected.begin(), expected.end());
+		assert(sorted == expected);
+	}
+
+	// Text: any separators, signs, duplicates, no trailing newline
+	char fileTemplate[] = "/tmp/rbt-keys-XXXXXX";
+	int fd = mkstemp(fileTemplate);
+	close(fd);
+	string path = fileTemplate;
+	{
+		ofstream out(path);
+		out << "5, -3\t17\n\n5 2147483647 -2147483648;0\r\n42";
+	}
+	RedBlackTree rbt = RedBlackTree();
+	rbt.Insert(1000);
+	RBTLoadReport report = LoadKeyFile(path, rbt, KeyFormat::Text, 4);
+	assert(report.keysRead == 8);
+	assert(report.keysLoaded == 7);
+	assert(rbt.Size() == 7);
+	assert(!rbt.Contains(1000));
+	assert(rbt.GetMin() == INT_MIN && rbt.GetMax() == INT_MAX);
+	assert(rbt.Contains(-3) && rbt.Contains(42));
+	assert(rbt.Validate());
+
+	// Big enough to be parsed in several chunks
+	{
+		ofstream out(path);
+		for (int key : keys) {
+			out << key << (key % 2 ? ' ' : '\n');
+		}
+	}
+	vector<int> distinct(keys);
+	sort(distinct.begin(), distinct.end());
+	distinct.erase(unique(distinct.begin(), distinct.end()), distinct.end());
+	assert(ReadSortedKeys(path, KeyFormat::Text, 4) == distinct);
+
+	// Binary
+	{
+		ofstream out(path, ios::binary);
+		out.write(reinterpret_cast<const char*>(keys.data()), keys.size() * sizeof(int));
+	}
+	report = LoadKeyFile(path, rbt, KeyFormat::Binary, 4);
+	assert(report.keysRead == keys.size());
+	assert(rbt.Size() == distinct.size());
+	vector<int> loaded;
+	rbt.ForEach([&loaded](int data) { loaded.push_back(data); });
+	assert(loaded == distinct);
+
+	// Malformed input and missing files throw
+	for (string bad : {"1 2 x3-", "99999999999", "1-2", "- 4"}) {
+		ofstream(path) << bad;
+		bool thrown = false;
+		try {
+			LoadKeyFile(path, rbt);
+		} catch (runtime_error &e) {
+			thrown = true;
+		}
+		assert(thrown);
+	}
+	ofstream(path) << "abc";
+	bool thrown = false;
+	try {
+		LoadKeyFile(path, rbt, KeyFormat::Binary);
+	} catch (runtime_error &e) {
+		thrown = true;
+	}
+	assert(thrown);
+	unlink(path.c_str());
+	thrown = false;
+	try {
+		LoadKeyFile(path, rbt);
+	} catch (runtime_error &e) {
+		thrown = true;
+	}
+	assert(thrown);
+
+	// Churn after a bulk load gives the dead part of the node block back
+	CountingResource counting;
+	{
+		RedBlackTree churned = RedBlackTree(&counting);
+		vector<int> sorted(100000);
+		for (int i = 0; i < 100000; i++) {
+			sorted[i] = i;
+		}
+		churned.LoadSorted(sorted);
+		size_t loadedBytes = counting.bytesInUse;
+		for (int i = 0; i < 100000; i += 10) {
+			for (int j = i; j < i + 7; j++) {
+				churned.Remove(j);
+			}
+		}
+		assert(churned.Size() == 30000);
+		assert(churned.Validate());
+		assert(counting.bytesInUse < loadedBytes / 2);
+		for (int i = 0; i < 100000; i++) {
+			if (i % 10 >= 7) churned.Remove(i);
+		}
+		assert(churned.Size() == 0);
+		assert(counting.bytesInUse < loadedBytes / 100);
+	}
+	assert(counting.bytesInUse == 0);
+
+	cout << "PASSED!" << endl << endl;
+}
+
+void TestKeySetServer() {
+	cout << "Testing Key Set Server..." << endl;
+
+	string socketPath = "/tmp/rbt-test-" + to_string(getpid()) + ".sock";
+	RedBlackTree rbt = RedBlackTree();
+	for (int i = 0; i < 100; i += 10) {
+		rbt.Insert(i);
+	}
+
+	KeySetServer server(socketPath, rbt);
+	thread serving([&server]() { server.Run(); });
+	{
+		KeySetClient client(socketPath);
+		assert(client.Contains(10));
+		assert(!client.Contains(11));
+		assert(client.Insert(11));
+		assert(!client.Insert(11));
+		assert(client.Remove(20));
+		assert(!client.Remove(20));
+
+		int value = 0;
+		assert(client.GetMin(value) && value == 0);
+		assert(client.GetMax(value) && value == 90);
+		assert(client.Range(11, 3) == vector<int>({11, 30, 40}));
+		assert(client.Range(91, 5).empty());
+
+		// Pipelined: many requests out before any reply comes back
+		for (int i = 1000; i < 3000; i++) {
+			client.Queue(KeySetOp::Insert, i);
+			client.Queue(KeySetOp::Contains, i);
+		}
+		client.Queue(KeySetOp::Range, 2995, 100);
+		assert(client.Queued() == 4001);
+		vector<KeySetReply> replies = client.Flush();
+		assert(replies.size() == 4001);
+		for (size_t i = 0; i + 1 < replies.size(); i++) {
+			assert(replies[i].ok);
+		}
+		assert(replies.back().keys == vector<int>({2995, 2996, 2997, 2998, 2999}));
+
+		// Several clients at once
+		vector<thread> clients;
+		for (int c = 0; c < 4; c++) {
+			clients.push_back(thread([&socketPath, c]() {
+				KeySetClient mine(socketPath);
+				for (int i = 0; i < 100; i++) {
+					mine.Queue(KeySetOp::Insert, 10000 + c * 100 + i);
+				}
+				for (KeySetReply &reply : mine.Flush()) {
+					assert(reply.ok);
+				}
+			}));
+		}
+		for (thread &c : clients) {
+			c.join();
+		}
+
+		// A batch whose replies far outgrow the server's backlog
+		for (int i = 0; i < 400; i++) {
+			client.Queue(KeySetOp::Range, INT_MIN, KeySetMaxRange);
+		}
+		replies = client.Flush();
+		assert(replies.size() == 400 && replies.back().keys.size() == 2410);
+	}
+	{
+		// A client that never reads: the server stops reading from it
+		// instead of buffering replies without bound
+		sockaddr_un addr = {};
+		addr.sun_family = AF_UNIX;
+		strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		assert(connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0);
+		fcntl(fd, F_SETFL, O_NONBLOCK);
+		char request[KeySetRequestBytes] = {static_cast<char>(KeySetOp::Range)};
+		int low = INT_MIN;
+		memcpy(request + 1, &low, sizeof(low));
+		memcpy(request + 5, &KeySetMaxRange, sizeof(KeySetMaxRange));
+		vector<char> flood;
+		for (int i = 0; i < 1000000; i++) {
+			flood.insert(flood.end(), request, request + KeySetRequestBytes);
+		}
+		size_t sent = 0;
+		bool stalled = false;
+		while (sent < flood.size()) {
+			ssize_t put = write(fd, flood.data() + sent, flood.size() - sent);
+			if (put > 0) {
+				sent += put;
+				stalled = false;
+				continue;
+			}
+			assert(errno == EAGAIN || errno == EWOULDBLOCK);
+			if (stalled) break;
+			stalled = true;
+			usleep(100000);
+		}
+		assert(sent < flood.size());
+		close(fd);
+
+		KeySetClient client(socketPath);
+		assert(client.Contains(10));
+	}
+	server.Stop();
+	serving.join();
+
+	assert(rbt.Size() == 10 + 2000 + 400);
+	assert(rbt.Contains(10399) && !rbt.Contains(20));
+	assert(rbt.Validate());
+	assert(server.Requests() > 4000);
+
+	// On a bounded tree, a key evicted as it goes in is not reported added
+	RedBlackTree top = RedBlackTree();
+	top.SetCapacity(2);
+	KeySetServer bounded(socketPath, top);
+	thread boundedServing([&bounded]() { bounded.Run(); });
+	{
+		KeySetClient client(socketPath);
+		assert(client.Insert(5));
+		assert(client.Insert(7));
+		assert(!client.Insert(1));
+		assert(client.Insert(9));
+		assert(!client.Contains(5));
+	}
+	bounded.Stop();
+	boundedServing.join();
+
+	bool thrown = false;
+	try {
+		KeySetClient nobody("/tmp/rbt-no-such-socket");
+	} catch (runtime_error &e) {
+		thrown = true;
+	}
+	assert(thrown);
+
+	cout << "PASSED!" << endl << endl;
+}
+
+void TestTopDownTree() {
+	cout << "Testing Top-Down Tree..." << endl;
+
+	TopDownRedBlackTree topDown;
+	RedBlackTree rbt = RedBlackTree();
+	mt19937 rng(47);
+	for (int i = 0; i < 5000; i++) {
+		int key = rng() % 20000;
+		if (rbt.Contains(key)) continue;
+		rbt.Insert(key);
+		topDown.Insert(key);
+	}
+	string problem;
+	assert(topDown.Validate(&problem));
+	assert(topDown.Size() == rbt.Size());
+	for (int i = 0; i < 20000; i++) {
+		assert(topDown.Contains(i) == rbt.Contains(i));
+	}
+
+	bool thrown = false;
+	try {
+		topDown.Insert(rbt.GetMin());
+	} catch (invalid_argument &e) {
+		thrown = true;
+	}
+	assert(thrown);
+	assert(topDown.Size() == rbt.Size());
+
+	// Interleaved ranges make the threads contend for the same paths
+	TopDownRedBlackTree shared;
+	vector<thread> threads;
+	for (int t = 0; t < 4; t++) {
+		threads.push_back(thread([&shared, t]() {
+			for (int i = t; i < 40000; i += 4) {
+				shared.Insert(i);
+				assert(shared.Contains(i));
+			}
+		}));
+	}
+	for (thread &t : threads) {
+		t.join();
+	}
+	assert(shared.Validate(&problem));
+	assert(shared.Size() == 40000);
+	assert(!shared.Contains(40000));
+
+	cout << "PASSED!" << endl << endl;
+}
+
 int main() {
 	TestSimpleConstructor();
 	TestConstructor();
@@ -701,6 +2532,32 @@ int main() {
 
 	TestPrivateMethods();
 
+	TestStats();
+	TestAnalyze();
+	TestInsertBuffer();
+	TestIntervalTree();
+	TestRemove();
+	TestMultiset();
+	TestAssignment();
+	TestLoadSorted();
+	TestDurableTree();
+	TestCompaction();
+	TestParallel();
+	TestStaticTree();
+	TestMemoryResource();
+	TestSharedTree();
+	TestEqualityAndDiff();
+	TestNearestKeys();
+	TestValidate();
+	TestHugePageResource();
+	TestLookupCache();
+	TestBloomFilter();
+	TestBoundedCapacity();
+	TestCompressedIntSet();
+	TestBulkLoader();
+	TestKeySetServer();
+	TestTopDownTree();
+
 	cout << "ALL TESTS PASSED!!" << endl;
 	return 0;
 }
@@ -0,0 +1,204 @@
+#include "SharedRedBlackTree.h"
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+#define SHARED_TREE_MAGIC 0x52425453u
+
+// Start of the segment; nodes follow it
+struct SharedRedBlackTree::Header {
+    uint32_t magic;
+    uint32_t root;
+    uint64_t numItems;
+    uint64_t capacity;
+    pthread_rwlock_t lock;
+};
+
+// Throw a runtime_error naming the failed call and segment
+static void ThrowIOError(const string &what, const string &name) {
+    throw runtime_error(what + " " + name + ": " + strerror(errno));
+}
+
+// Holds the shared lock for reading or writing until it goes out of scope
+class SharedLockGuard {
+    public:
+        SharedLockGuard(pthread_rwlock_t *lock, bool write) : lock(lock) {
+            if (write) pthread_rwlock_wrlock(lock);
+            else pthread_rwlock_rdlock(lock);
+        }
+        ~SharedLockGuard() {
+            pthread_rwlock_unlock(lock);
+        }
+
+    private:
+        pthread_rwlock_t *lock;
+};
+
+// Create (or replace) the named segment with room for capacity nodes
+SharedRedBlackTree SharedRedBlackTree::Create(const string &name, size_t capacity) {
+    size_t length = NodesOffset() + capacity * sizeof(SharedRBTNode);
+    if (length > UINT32_MAX) {
+        throw invalid_argument("Shared tree segment must fit 32-bit offsets");
+    }
+
+    int fd = shm_open(name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0600);
+    if (fd < 0) ThrowIOError("shm_open", name);
+    if (ftruncate(fd, length) != 0) {
+        close(fd);
+        ThrowIOError("ftruncate", name);
+    }
+    void* mapped = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) ThrowIOError("mmap", name);
+
+    SharedRedBlackTree srbt(static_cast<char*>(mapped), length);
+    Header* header = srbt.GetHeader();
+    header->root = 0;
+    header->numItems = 0;
+    header->capacity = capacity;
+
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_rwlock_init(&header->lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+
+    // Attach() only trusts a segment once this is set
+    header->magic = SHARED_TREE_MAGIC;
+    return srbt;
+}
+
+// Map an existing segment; no copying, so this is O(1)
+SharedRedBlackTree SharedRedBlackTree::Attach(const string &name) {
+    // Readers still write to the lock, so the mapping must be writable
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0) ThrowIOError("shm_open", name);
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        ThrowIOError("fstat", name);
+    }
+    size_t length = st.st_size;
+    if (length < NodesOffset()) {
+        close(fd);
+        throw runtime_error("Not a shared tree segment: " + name);
+    }
+    void* mapped = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) ThrowIOError("mmap", name);
+
+    SharedRedBlackTree srbt(static_cast<char*>(mapped), length);
+    if (srbt.GetHeader()->magic != SHARED_TREE_MAGIC) {
+        throw runtime_error("Not a shared tree segment: " + name);
+    }
+    return srbt;
+}
+
+// Remove the segment's name; mappings stay valid until they are dropped
+void SharedRedBlackTree::Unlink(const string &name) {
+    if (shm_unlink(name.c_str()) != 0 && errno != ENOENT) ThrowIOError("shm_unlink", name);
+}
+
+// Move Constructor: Take over another handle's mapping
+SharedRedBlackTree::SharedRedBlackTree(SharedRedBlackTree &&srbt) : base(srbt.base), length(srbt.length) {
+    srbt.base = nullptr;
+    srbt.length = 0;
+}
+
+// Destructor: Unmap the segment (the shared tree itself lives on)
+SharedRedBlackTree::~SharedRedBlackTree() {
+    if (base != nullptr) munmap(base, length);
+}
+
+// Replace the shared tree with a copy of tree's nodes and colours
+void SharedRedBlackTree::Publish(const RedBlackTree &tree) {
+    if (tree.Buffered() > 0) {
+        throw invalid_argument("Flush the insert buffer before publishing");
+    }
+    Header* header = GetHeader();
+    if (tree.Size() > header->capacity) {
+        throw invalid_argument("Tree does not fit in the shared segment");
+    }
+
+    SharedLockGuard guard(&header->lock, true);
+    uint32_t next = NodesOffset();
+    header->root = CopyOf(tree.root, 0, next);
+    header->numItems = tree.Size();
+}
+
+// Copy a subtree into the segment at next (pre-order) and return its offset
+uint32_t SharedRedBlackTree::CopyOf(const RBTNode* node, uint32_t parent, uint32_t &next) {
+    if (node == nullptr) return 0;
+    uint32_t offset = next;
+    next += sizeof(SharedRBTNode);
+
+    SharedRBTNode* copy = reinterpret_cast<SharedRBTNode*>(base + offset);
+    copy->data = node->data;
+    copy->color = node->color;
+    copy->parent = parent;
+    copy->left = CopyOf(node->left, offset, next);
+    copy->right = CopyOf(node->right, offset, next);
+    return offset;
+}
+
+// Check if a given value exists in the shared tree
+bool SharedRedBlackTree::Contains(int data) const {
+    SharedLockGuard guard(&GetHeader()->lock, false);
+    const SharedRBTNode* curr = NodeAt(GetHeader()->root);
+    while (curr != nullptr) {
+        if (data == curr->data) return true;
+        curr = NodeAt((data < curr->data) ? curr->left : curr->right);
+    }
+    return false;
+}
+
+// Number of keys in the shared tree
+size_t SharedRedBlackTree::Size() const {
+    SharedLockGuard guard(&GetHeader()->lock, false);
+    return GetHeader()->numItems;
+}
+
+// Most nodes the segment can hold
+size_t SharedRedBlackTree::Capacity() const {
+    return GetHeader()->capacity;
+}
+
+// Get minimum value in the shared tree (leftmost node)
+int SharedRedBlackTree::GetMin() const {
+    SharedLockGuard guard(&GetHeader()->lock, false);
+    const SharedRBTNode* curr = NodeAt(GetHeader()->root);
+    if (curr == nullptr) throw invalid_argument("Tree is empty");
+    while (curr->left != 0) curr = NodeAt(curr->left);
+    return curr->data;
+}
+
+// Get maximum value in the shared tree (rightmost node)
+int SharedRedBlackTree::GetMax() const {
+    SharedLockGuard guard(&GetHeader()->lock, false);
+    const SharedRBTNode* curr = NodeAt(GetHeader()->root);
+    if (curr == nullptr) throw invalid_argument("Tree is empty");
+    while (curr->right != 0) curr = NodeAt(curr->right);
+    return curr->data;
+}
+
+SharedRedBlackTree::Header* SharedRedBlackTree::GetHeader() const {
+    return reinterpret_cast<Header*>(base);
+}
+
+// Byte offset of the first node, past the header and suitably aligned
+size_t SharedRedBlackTree::NodesOffset() {
+    size_t align = alignof(SharedRBTNode);
+    return (sizeof(Header) + align - 1) / align * align;
+}
+
+// Resolve an offset in this process's mapping
+const SharedRBTNode* SharedRedBlackTree::NodeAt(uint32_t offset) const {
+    return offset == 0 ? nullptr : reinterpret_cast<const SharedRBTNode*>(base + offset);
+}
@@ -0,0 +1,65 @@
+#ifndef SHAREDREDBLACKTREE_H
+#define SHAREDREDBLACKTREE_H
+
+#include "RedBlackTree.h"
+#include <cstdint>
+#include <string>
+
+using namespace std;
+
+
+// Red-black node stored in a shared memory segment. Links are 32-bit
+// byte offsets from the start of the segment (0 = null), so they mean
+// the same thing in every process, wherever the segment is mapped.
+struct SharedRBTNode {
+	int data;
+	uint32_t left;
+	uint32_t right;
+	uint32_t parent;
+	unsigned short int color;
+};
+
+
+// A read-mostly RedBlackTree shared between processes through a
+// shm_open/mmap segment. One process creates the segment and Publish()es
+// a tree into it; the others Attach() in O(1) and query the single copy.
+// A process-shared reader/writer lock keeps readers off a tree that is
+// being republished.
+class SharedRedBlackTree {
+
+	public:
+		// Create (or replace) the named segment with room for capacity nodes
+		static SharedRedBlackTree Create(const string &name, size_t capacity);
+		static SharedRedBlackTree Attach(const string &name);
+		static void Unlink(const string &name);
+
+		SharedRedBlackTree(SharedRedBlackTree &&srbt);
+		SharedRedBlackTree(const SharedRedBlackTree &srbt) = delete;
+		SharedRedBlackTree &operator=(const SharedRedBlackTree &srbt) = delete;
+		~SharedRedBlackTree();
+
+		// Replace the shared tree with a copy of tree's nodes and colours
+		void Publish(const RedBlackTree &tree);
+
+		bool Contains(int data) const;
+		size_t Size() const;
+		size_t Capacity() const;
+		int GetMin() const;
+		int GetMax() const;
+
+	private:
+		struct Header;
+
+		char *base = nullptr;
+		size_t length = 0;
+
+		SharedRedBlackTree(char *base, size_t length) : base(base), length(length) {};
+
+		Header *GetHeader() const;
+		static size_t NodesOffset();
+		const SharedRBTNode *NodeAt(uint32_t offset) const;
+		uint32_t CopyOf(const RBTNode *node, uint32_t parent, uint32_t &next);
+
+};
+
+#endif
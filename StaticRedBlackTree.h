@@ -0,0 +1,139 @@
+#ifndef STATICREDBLACKTREE_H
+#define STATICREDBLACKTREE_H
+
+#include "RedBlackTree.h"
+#include "RedBlackTreeBalance.h"
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+
+// A red-black tree over N keys that can be built and searched at compile
+// time (C++20), so a fixed key set lives in read-only data with no heap
+// and no startup cost:
+//
+//   constexpr int keys[] = {12, 11, 15};
+//   constexpr StaticRedBlackTree<3> table(keys);
+//   static_assert(table.Contains(11));
+//
+// Keys go in through the same InsertFixUp and rotations as
+// RedBlackTree::Insert() (RedBlackTreeBalance.h), so both trees print the
+// same ToPrefixString(). Nodes link by index instead of by pointer so the
+// tree can be copied out of a constant expression.
+template <size_t N>
+class StaticRedBlackTree {
+
+	static_assert(N > 0, "StaticRedBlackTree needs at least one key");
+
+	public:
+		constexpr StaticRedBlackTree(const int (&keys)[N]) {
+			for (size_t i = 0; i < N; i++) Insert(keys[i]);
+		};
+
+		constexpr size_t Size() const {return numItems;};
+
+		constexpr bool Contains(int data) const {
+			int curr = root;
+			while (curr != NONE) {
+				if (data == nodes[curr].data) return true;
+				curr = (data < nodes[curr].data) ? nodes[curr].left : nodes[curr].right;
+			}
+			return false;
+		};
+
+		constexpr int GetMin() const {
+			int curr = root;
+			while (nodes[curr].left != NONE) curr = nodes[curr].left;
+			return nodes[curr].data;
+		};
+
+		constexpr int GetMax() const {
+			int curr = root;
+			while (nodes[curr].right != NONE) curr = nodes[curr].right;
+			return nodes[curr].data;
+		};
+
+		string ToPrefixString() const {return ToPrefixString(root);};
+
+	private:
+		static constexpr int NONE = -1;
+
+		struct Node {
+			int data = 0;
+			unsigned short int color = COLOR_RED;
+			int left = NONE;
+			int right = NONE;
+			int parent = NONE;
+		};
+
+		Node nodes[N];
+		int root = NONE;
+		size_t numItems = 0;
+
+		constexpr void Insert(int newData) {
+			if (Contains(newData)) {
+				throw invalid_argument("Duplicate value not allowed in StaticRedBlackTree");
+			}
+
+			int node = numItems++;
+			nodes[node].data = newData;
+
+			if (root == NONE) {
+				nodes[node].color = COLOR_BLACK;
+				root = node;
+				return;
+			}
+
+			BasicInsert(node);
+			if (nodes[nodes[node].parent].color == COLOR_RED) {
+				InsertFixUp(node);
+			}
+			nodes[root].color = COLOR_BLACK;
+		};
+
+		constexpr void BasicInsert(int node) {
+			int curr = root;
+			int parent = NONE;
+			while (curr != NONE) {
+				parent = curr;
+				curr = (nodes[node].data < nodes[curr].data) ? nodes[curr].left : nodes[curr].right;
+			}
+			nodes[node].parent = parent;
+			if (nodes[node].data < nodes[parent].data) {
+				nodes[parent].left = node;
+			} else {
+				nodes[parent].right = node;
+			}
+		};
+
+		// Index links for the shared balancing code; rotations carry no
+		// per-node state here and nothing is counted
+		struct Links {
+			StaticRedBlackTree &tree;
+
+			static constexpr int NONE = StaticRedBlackTree::NONE;
+
+			constexpr int &Left(int n) const {return tree.nodes[n].left;};
+			constexpr int &Right(int n) const {return tree.nodes[n].right;};
+			constexpr int &Parent(int n) const {return tree.nodes[n].parent;};
+			constexpr unsigned short int &Color(int n) const {return tree.nodes[n].color;};
+			constexpr int &Root() const {return tree.root;};
+
+			constexpr void Rotated(int, int) const {};
+			constexpr void Step(RBTStep) const {};
+		};
+
+		constexpr void InsertFixUp(int node) {
+			RBTInsertFixUp(Links{*this}, node);
+		};
+
+		string ToPrefixString(int n) const {
+			if (n == NONE) return "";
+			string color = nodes[n].color == COLOR_RED ? "R" : "B";
+			return " " + color + to_string(nodes[n].data) + " " + ToPrefixString(nodes[n].left) + ToPrefixString(nodes[n].right);
+		};
+
+};
+
+#endif
@@ -0,0 +1,186 @@
+#include "TopDownRedBlackTree.h"
+#include <stdexcept>
+#include <thread>
+
+using namespace std;
+
+// Spin until the lock is ours, yielding so a preempted holder can finish
+void TopDownRBTNode::Lock() {
+    while (locked.exchange(true, memory_order_acquire)) {
+        while (locked.load(memory_order_relaxed)) this_thread::yield();
+    }
+}
+
+TopDownRedBlackTree::~TopDownRedBlackTree() {
+    FreeTree(head.link[1]);
+}
+
+void TopDownRedBlackTree::FreeTree(TopDownRBTNode *node) {
+    if (node == nullptr) return;
+    FreeTree(node->link[0]);
+    FreeTree(node->link[1]);
+    delete node;
+}
+
+bool TopDownRedBlackTree::IsRed(const TopDownRBTNode *node) {
+    return node != nullptr && node->red;
+}
+
+// Rotate root's child on side !dir up into root's place, towards dir;
+// the new subtree root turns black and the old one red
+TopDownRBTNode *TopDownRedBlackTree::Single(TopDownRBTNode *root, int dir) {
+    TopDownRBTNode *save = root->link[!dir];
+    root->link[!dir] = save->link[dir];
+    save->link[dir] = root;
+    root->red = true;
+    save->red = false;
+    return save;
+}
+
+// Rotate the inner grandchild up twice into root's place
+TopDownRBTNode *TopDownRedBlackTree::Double(TopDownRBTNode *root, int dir) {
+    root->link[!dir] = Single(root->link[!dir], !dir);
+    return Single(root, dir);
+}
+
+// Single-pass top-down insert. q walks down from the root with its parent
+// p, grandparent g and great-grandparent t; a flip at q that leaves q
+// and p both red is fixed by rotating at g and relinking it under t. All
+// four stay locked, each new q being locked before the old t is let go.
+// Right after a rotation t can trail g for one step, but no rotation can
+// happen in that step (the new q is black), so it is never used stale.
+void TopDownRedBlackTree::Insert(int data) {
+    TopDownRBTNode *t = &head;
+    TopDownRBTNode *g = nullptr;
+    TopDownRBTNode *p = nullptr;
+    head.Lock();
+    TopDownRBTNode *q = head.link[1];
+    if (q == nullptr) {
+        q = new TopDownRBTNode;
+        q->data = data;
+        q->red = false;
+        head.link[1] = q;
+        numItems++;
+        head.Unlock();
+        return;
+    }
+    q->Lock();
+
+    int dir = 1;
+    int last = 1;
+    bool inserted = false;
+    while (true) {
+        if (q == nullptr) {
+            q = new TopDownRBTNode;
+            q->data = data;
+            q->Lock();
+            p->link[dir] = q;
+            numItems++;
+            inserted = true;
+        } else if (IsRed(q->link[0]) && IsRed(q->link[1])) {
+            // Split the 4-node: its children take q's blackness
+            TopDownRBTNode *left = q->link[0];
+            TopDownRBTNode *right = q->link[1];
+            left->Lock();
+            right->Lock();
+            q->red = true;
+            left->red = false;
+            right->red = false;
+            right->Unlock();
+            left->Unlock();
+        }
+
+        // The root stays black
+        if (p == nullptr) q->red = false;
+
+        if (IsRed(q) && IsRed(p)) {
+            int dir2 = t->link[1] == g;
+            if (q == p->link[last]) {
+                t->link[dir2] = Single(g, !last);
+            } else {
+                t->link[dir2] = Double(g, !last);
+            }
+        }
+
+        if (q->data == data) break;
+
+        // After a double rotation q's children are the old g and p, so
+        // the next node may already be held
+        last = dir;
+        dir = q->data < data;
+        TopDownRBTNode *next = q->link[dir];
+        if (next != nullptr && next != t && next != g && next != p) next->Lock();
+
+        TopDownRBTNode *dropped = nullptr;
+        if (g != nullptr) {
+            dropped = t;
+            t = g;
+        }
+        g = p;
+        p = q;
+        q = next;
+        if (dropped != nullptr && dropped != t && dropped != g && dropped != p && dropped != q) dropped->Unlock();
+    }
+
+    // The flips and rotations on the way down are valid either way
+    q->Unlock();
+    if (p != nullptr && p != q) p->Unlock();
+    if (g != nullptr && g != q && g != p) g->Unlock();
+    if (t != q && t != p && t != g) t->Unlock();
+    if (!inserted) {
+        throw invalid_argument("Duplicate value not allowed in TopDownRedBlackTree");
+    }
+}
+
+// Hand-over-hand search: lock the child, then let go of the parent
+bool TopDownRedBlackTree::Contains(int data) const {
+    head.Lock();
+    TopDownRBTNode *curr = head.link[1];
+    TopDownRBTNode *held = &head;
+    while (curr != nullptr) {
+        curr->Lock();
+        held->Unlock();
+        held = curr;
+        if (curr->data == data) break;
+        curr = curr->link[curr->data < data];
+    }
+    held->Unlock();
+    return curr != nullptr;
+}
+
+// Check ordering, red-red, black height, a black root and the size
+bool TopDownRedBlackTree::Validate(string *problem) const {
+    string found;
+    size_t count = 0;
+    const TopDownRBTNode *root = head.link[1];
+    if (IsRed(root)) found = "root is red";
+    else if (Validate(root, nullptr, nullptr, count, found) >= 0 && count != numItems) {
+        found = "size is " + to_string(numItems) + " but the tree holds " + to_string(count);
+    }
+    if (problem != nullptr) *problem = found;
+    return found.empty();
+}
+
+// Black height of node's subtree (keys strictly between low and high,
+// when given), or -1 after recording the first problem
+int TopDownRedBlackTree::Validate(const TopDownRBTNode *node, const int *low, const int *high, size_t &count, string &problem) {
+    if (node == nullptr) return 0;
+    count++;
+    if ((low != nullptr && node->data <= *low) || (high != nullptr && node->data >= *high)) {
+        problem = "key " + to_string(node->data) + " is out of order";
+        return -1;
+    }
+    if (node->red && (IsRed(node->link[0]) || IsRed(node->link[1]))) {
+        problem = "red node " + to_string(node->data) + " has a red child";
+        return -1;
+    }
+    int left = Validate(node->link[0], low, &node->data, count, problem);
+    if (left < 0) return -1;
+    int right = Validate(node->link[1], &node->data, high, count, problem);
+    if (right < 0) return -1;
+    if (left != right) {
+        problem = "black heights differ below " + to_string(node->data);
+        return -1;
+    }
+    return left + (node->red ? 0 : 1);
+}
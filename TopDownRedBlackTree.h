@@ -0,0 +1,64 @@
+#ifndef TOPDOWNREDBLACKTREE_H
+#define TOPDOWNREDBLACKTREE_H
+
+#include <atomic>
+#include <string>
+
+using namespace std;
+
+
+// Red-black node without a parent pointer: 24 bytes against RBTNode's 48.
+// link[0] is the left child and link[1] the right. locked is a spinlock
+// for lock coupling.
+struct TopDownRBTNode {
+	int data;
+	bool red = true;
+	atomic<bool> locked{false};
+	TopDownRBTNode *link[2] = {nullptr, nullptr};
+
+	void Lock();
+	void Unlock() {locked.store(false, memory_order_release);};
+};
+
+
+// Insert-only red-black tree balanced top-down: on the way down it splits
+// every node with two red children (a colour flip) and repairs a red-red
+// pair with a rotation two levels up, so the insert finishes at the leaf
+// and never walks back up. Nothing looks at a node's parent, so nodes
+// carry none.
+//
+// Each change touches only the four nodes nearest the current one on the
+// path (plus, for a flip, its children), so Insert() and Contains() hold
+// locks on just that window and hand them over on the way down. Writers
+// in disjoint subtrees then only contend near the root.
+class TopDownRedBlackTree {
+
+	public:
+		TopDownRedBlackTree() {};
+		TopDownRedBlackTree(const TopDownRedBlackTree &tdrbt) = delete;
+		TopDownRedBlackTree &operator=(const TopDownRedBlackTree &tdrbt) = delete;
+		~TopDownRedBlackTree();
+
+		// Safe to call from many threads at once
+		void Insert(int data);
+		bool Contains(int data) const;
+		size_t Size() const {return numItems;};
+
+		// Red-black and BST invariants; not while other threads write
+		bool Validate(string *problem = nullptr) const;
+
+	private:
+		// Sentinel above the root (the root is head.link[1]), so a rotation
+		// at the root relinks it like any other node
+		mutable TopDownRBTNode head;
+		atomic<size_t> numItems{0};
+
+		static bool IsRed(const TopDownRBTNode *node);
+		static TopDownRBTNode *Single(TopDownRBTNode *root, int dir);
+		static TopDownRBTNode *Double(TopDownRBTNode *root, int dir);
+		static int Validate(const TopDownRBTNode *node, const int *low, const int *high, size_t &count, string &problem);
+		static void FreeTree(TopDownRBTNode *node);
+
+};
+
+#endif